@@ -0,0 +1,239 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  BitVector. Word-level bit container
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __BITVECTOR__H__
+#define __BITVECTOR__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <vector>
+#include <algorithm>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BITVECTOR_SSE2
+#endif
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- Bits are kept in 64-bit words, bit n at position n % 64 of word n / 64, so
+appending or extracting up to 64 bits is one or two shifts instead of a loop
+with a division per bit.
+
+- The serialized form (CopyBytes, the byte constructor) is the one the .pyr
+streams always used: bytes in order, first bit in the most significant
+position. Bytes are bit-reversed on the way in and out.
+
+- AppendSigns packs the sign bits of 16 residuals at a time from the SSE2
+movemask of the saturated values.
+
+- The container is move-only; sign bits, significance maps and bit-plane
+layers are handed over without copying.
+
+*/
+
+//===========================================================================
+//===========================================================================
+#define BITVECTOR_WORD_BITS		64
+#define BITVECTOR_BYTE_BITS		8
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+class BitVector
+{
+private:
+	std::vector<unsigned long long> vecWords;
+	unsigned int intSize;
+
+	//===========================================================================
+	//===========================================================================
+	static unsigned char ReverseByte(unsigned int intByte)
+	{
+		intByte = ((intByte & 0xF0) >> 4) | ((intByte & 0x0F) << 4);
+		intByte = ((intByte & 0xCC) >> 2) | ((intByte & 0x33) << 2);
+		intByte = ((intByte & 0xAA) >> 1) | ((intByte & 0x55) << 1);
+		return (unsigned char)intByte;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	static unsigned long long LowBits(unsigned long long intBits, unsigned int intCount)
+	{
+		return intCount < BITVECTOR_WORD_BITS ? intBits & ((1ULL << intCount) - 1) : intBits;
+	}
+
+	BitVector(const BitVector&);
+	BitVector& operator=(const BitVector&);
+
+public:
+	//===========================================================================
+	//===========================================================================
+	BitVector() : intSize(0) {}
+
+	//===========================================================================
+	//===========================================================================
+	BitVector(const unsigned char* pBytes, unsigned int intBits) : intSize(intBits)
+	{
+		vecWords.assign((intBits + BITVECTOR_WORD_BITS - 1) / BITVECTOR_WORD_BITS, 0);
+		unsigned int intBytes = (intBits + BITVECTOR_BYTE_BITS - 1) / BITVECTOR_BYTE_BITS;
+		for (unsigned int i = 0; i < intBytes; i++)
+			vecWords[i / BITVECTOR_BYTE_BITS] |= (unsigned long long)ReverseByte(pBytes[i]) << (BITVECTOR_BYTE_BITS * (i % BITVECTOR_BYTE_BITS));
+		if (intBits % BITVECTOR_WORD_BITS != 0)
+			vecWords.back() = LowBits(vecWords.back(), intBits % BITVECTOR_WORD_BITS);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	BitVector(BitVector&& other) : vecWords(std::move(other.vecWords)), intSize(other.intSize)
+	{
+		other.intSize = 0;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	BitVector& operator=(BitVector&& other)
+	{
+		vecWords = std::move(other.vecWords);
+		intSize = other.intSize;
+		other.intSize = 0;
+		return *this;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	void Reserve(unsigned int intBits)
+	{
+		vecWords.reserve((intBits + BITVECTOR_WORD_BITS - 1) / BITVECTOR_WORD_BITS);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	void Add(unsigned char bit)
+	{
+		if (intSize % BITVECTOR_WORD_BITS == 0)
+			vecWords.push_back(0);
+		vecWords.back() |= (unsigned long long)(bit & 1) << (intSize % BITVECTOR_WORD_BITS);
+		intSize++;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	// Appends the low intCount bits of intBits, least significant first
+	void Append(unsigned long long intBits, unsigned int intCount)
+	{
+		if (intCount == 0)
+			return;
+		intBits = LowBits(intBits, intCount);
+		unsigned int intOffset = intSize % BITVECTOR_WORD_BITS;
+		if (intOffset == 0)
+			vecWords.push_back(intBits);
+		else
+		{
+			vecWords.back() |= intBits << intOffset;
+			if (intOffset + intCount > BITVECTOR_WORD_BITS)
+				vecWords.push_back(intBits >> (BITVECTOR_WORD_BITS - intOffset));
+		}
+		intSize += intCount;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	void Append(const BitVector& other)
+	{
+		for (unsigned int i = 0; i < other.vecWords.size(); i++)
+			Append(other.vecWords[i], std::min<unsigned int>(BITVECTOR_WORD_BITS, other.intSize - i * BITVECTOR_WORD_BITS));
+	}
+
+	//===========================================================================
+	//===========================================================================
+	// One bit per value, set for negative values
+	void AppendSigns(const short* pValues, unsigned int intCount)
+	{
+		unsigned int i = 0;
+#ifdef BITVECTOR_SSE2
+		for (; i + 16 <= intCount; i += 16)
+		{
+			__m128i lo = _mm_loadu_si128((const __m128i*)(pValues + i));
+			__m128i hi = _mm_loadu_si128((const __m128i*)(pValues + i + 8));
+			Append((unsigned int)_mm_movemask_epi8(_mm_packs_epi16(lo, hi)), 16);
+		}
+#endif
+		for (; i < intCount; i++)
+			Add(pValues[i] < 0 ? 1 : 0);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	// Returns intCount <= 64 bits starting at intIndex, first bit least significant
+	unsigned long long Extract(unsigned int intIndex, unsigned int intCount) const
+	{
+		unsigned int intWord = intIndex / BITVECTOR_WORD_BITS;
+		unsigned int intOffset = intIndex % BITVECTOR_WORD_BITS;
+		unsigned long long intBits = vecWords[intWord] >> intOffset;
+		if (intOffset != 0 && intOffset + intCount > BITVECTOR_WORD_BITS && intWord + 1 < vecWords.size())
+			intBits |= vecWords[intWord + 1] << (BITVECTOR_WORD_BITS - intOffset);
+		return LowBits(intBits, intCount);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	unsigned char operator[](unsigned int intIndex) const
+	{
+		return (unsigned char)((vecWords[intIndex / BITVECTOR_WORD_BITS] >> (intIndex % BITVECTOR_WORD_BITS)) & 1);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	unsigned int GetSize() const
+	{
+		return intSize;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	unsigned int GetByteSize() const
+	{
+		return (intSize + BITVECTOR_BYTE_BITS - 1) / BITVECTOR_BYTE_BITS;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	void CopyBytes(unsigned char* pBytes) const
+	{
+		unsigned int intBytes = GetByteSize();
+		for (unsigned int i = 0; i < intBytes; i++)
+			pBytes[i] = ReverseByte((unsigned int)(vecWords[i / BITVECTOR_BYTE_BITS] >> (BITVECTOR_BYTE_BITS * (i % BITVECTOR_BYTE_BITS))) & 0xFF);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	std::vector<unsigned char> GetBytes() const
+	{
+		std::vector<unsigned char> vecBytes(GetByteSize());
+		if (!vecBytes.empty())
+			CopyBytes(&vecBytes[0]);
+		return vecBytes;
+	}
+};
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
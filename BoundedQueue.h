@@ -0,0 +1,276 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  BoundedQueue. Lock-free bounded queue between pipeline stages
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __BOUNDEDQUEUE__H__
+#define __BOUNDEDQUEUE__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- A ring of cells, each with its own sequence number (Vyukov's bounded
+multi-producer multi-consumer queue). A producer claims a slot by advancing
+the enqueue position with a compare-and-swap, writes the value and publishes
+it by bumping the cell sequence; consumers mirror this on the dequeue side.
+No locks are taken, so a stage never waits on another stage's critical
+section.
+
+- Push blocks while the queue is full, which is the back-pressure: a fast
+reader cannot run more than the capacity ahead of the encoders. Pop blocks
+while the queue is empty and returns false once the queue is closed and
+drained. A blocked caller yields for a few rounds, then sleeps on a condition
+variable; Push and Pop only take the mutex to wake a sleeper when the waiter
+count says there is one, so the uncontended path stays lock-free. Close
+wakes every sleeper.
+
+- T must be cheap to copy (the pipeline passes small structs of pointers).
+
+- Every Push samples the depth, so the queue can report how full it ran.
+
+*/
+
+//===========================================================================
+//===========================================================================
+template <typename T>
+class BoundedQueue
+{
+private:
+	struct Cell
+	{
+		std::atomic<size_t> intSequence;
+		T value;
+	};
+
+	Cell* pCells;
+	size_t intMask;
+	std::atomic<size_t> intEnqueue;
+	std::atomic<size_t> intDequeue;
+	std::atomic<bool> boolClosed;
+
+	std::mutex mutexWait;
+	std::condition_variable condNotFull;
+	std::condition_variable condNotEmpty;
+	std::atomic<unsigned int> intPushWaiters;
+	std::atomic<unsigned int> intPopWaiters;
+
+	std::atomic<size_t> intMaxDepth;
+	std::atomic<unsigned long long> intDepthSum;
+	std::atomic<unsigned long long> intPushes;
+
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+
+	// Yield rounds before a blocked Push or Pop goes to sleep
+	enum { SPIN_COUNT = 64 };
+
+	//===========================================================================
+	//===========================================================================
+	// The fence pairs with the one in WaitFor: either the sleeper sees the new
+	// state under the lock, or this sees its waiter count
+	void Wake(std::atomic<unsigned int>& intWaiters, std::condition_variable& cond)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (intWaiters.load(std::memory_order_relaxed) != 0)
+		{
+			std::lock_guard<std::mutex> lock(mutexWait);
+			cond.notify_all();
+		}
+	}
+
+	//===========================================================================
+	//===========================================================================
+	template <typename Ready>
+	void WaitFor(std::atomic<unsigned int>& intWaiters, std::condition_variable& cond, Ready ready)
+	{
+		intWaiters.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		{
+			std::unique_lock<std::mutex> lock(mutexWait);
+			cond.wait(lock, ready);
+		}
+		intWaiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+public:
+	//===========================================================================
+	//===========================================================================
+	// The capacity is rounded up to a power of two
+	BoundedQueue(size_t intCapacity) : intEnqueue(0), intDequeue(0), boolClosed(false),
+		intPushWaiters(0), intPopWaiters(0), intMaxDepth(0), intDepthSum(0), intPushes(0)
+	{
+		size_t intSize = 2;
+		while (intSize < intCapacity)
+			intSize *= 2;
+		pCells = new Cell[intSize];
+		intMask = intSize - 1;
+		for (size_t i = 0; i < intSize; i++)
+			pCells[i].intSequence.store(i, std::memory_order_relaxed);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	~BoundedQueue()
+	{
+		delete[] pCells;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	bool TryPush(const T& value)
+	{
+		size_t intPos = intEnqueue.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = pCells[intPos & intMask];
+			size_t intSequence = cell.intSequence.load(std::memory_order_acquire);
+			if (intSequence == intPos)
+			{
+				if (intEnqueue.compare_exchange_weak(intPos, intPos + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.intSequence.store(intPos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (intSequence < intPos)
+				return false;
+			else
+				intPos = intEnqueue.load(std::memory_order_relaxed);
+		}
+	}
+
+	//===========================================================================
+	//===========================================================================
+	bool TryPop(T& value)
+	{
+		size_t intPos = intDequeue.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = pCells[intPos & intMask];
+			size_t intSequence = cell.intSequence.load(std::memory_order_acquire);
+			if (intSequence == intPos + 1)
+			{
+				if (intDequeue.compare_exchange_weak(intPos, intPos + 1, std::memory_order_relaxed))
+				{
+					value = cell.value;
+					cell.intSequence.store(intPos + intMask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (intSequence < intPos + 1)
+				return false;
+			else
+				intPos = intDequeue.load(std::memory_order_relaxed);
+		}
+	}
+
+	//===========================================================================
+	//===========================================================================
+	void Push(const T& value)
+	{
+		bool boolPushed = false;
+		for (int i = 0; i < SPIN_COUNT && !(boolPushed = TryPush(value)); i++)
+			std::this_thread::yield();
+		if (!boolPushed)
+			WaitFor(intPushWaiters, condNotFull, [&]() { return TryPush(value); });
+		Wake(intPopWaiters, condNotEmpty);
+
+		size_t intDepth = GetDepth();
+		size_t intMax = intMaxDepth.load(std::memory_order_relaxed);
+		while (intDepth > intMax && !intMaxDepth.compare_exchange_weak(intMax, intDepth, std::memory_order_relaxed))
+			;
+		intDepthSum.fetch_add(intDepth, std::memory_order_relaxed);
+		intPushes.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	// Returns false when the queue is closed and empty
+	bool Pop(T& value)
+	{
+		bool boolPopped = false;
+		for (int i = 0; i < SPIN_COUNT && !(boolPopped = TryPop(value)); i++)
+		{
+			if (boolClosed.load(std::memory_order_acquire))
+				return TryPop(value);
+			std::this_thread::yield();
+		}
+		if (!boolPopped)
+		{
+			WaitFor(intPopWaiters, condNotEmpty, [&]() {
+				return (boolPopped = TryPop(value)) || boolClosed.load(std::memory_order_acquire);
+			});
+			if (!boolPopped)
+				return TryPop(value);
+		}
+		Wake(intPushWaiters, condNotFull);
+		return true;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	// Called once all producers are done
+	void Close()
+	{
+		boolClosed.store(true, std::memory_order_release);
+		std::lock_guard<std::mutex> lock(mutexWait);
+		condNotEmpty.notify_all();
+		condNotFull.notify_all();
+	}
+
+	//===========================================================================
+	//===========================================================================
+	size_t GetDepth() const
+	{
+		size_t intIn = intEnqueue.load(std::memory_order_relaxed);
+		size_t intOut = intDequeue.load(std::memory_order_relaxed);
+		return intIn > intOut ? intIn - intOut : 0;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	size_t GetCapacity() const
+	{
+		return intMask + 1;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	size_t GetMaxDepth() const
+	{
+		return intMaxDepth.load();
+	}
+
+	//===========================================================================
+	//===========================================================================
+	double GetAverageDepth() const
+	{
+		unsigned long long intCount = intPushes.load();
+		return intCount != 0 ? double(intDepthSum.load()) / intCount : 0;
+	}
+};
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,128 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Checksum. CRC32C of byte buffers
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "Checksum.h"
+
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <nmmintrin.h>
+#define CHECKSUM_SSE42
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CHECKSUM_TARGET
+#else
+#include <cpuid.h>
+#define CHECKSUM_TARGET		__attribute__((target("sse4.2")))
+#endif
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#define CRC32C_POLYNOMIAL	0x82F63B78
+//===========================================================================
+//===========================================================================
+
+/*
+ *
+ *    Table-driven fallback
+ *
+ *    Reflected CRC, one byte per step. The table is filled by a static
+ *    object before main runs, so concurrent first calls are safe.
+ *
+ */
+//===========================================================================
+//===========================================================================
+static unsigned int arrCrcTable[256];
+
+static struct CrcTableInit
+{
+	CrcTableInit()
+	{
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			unsigned int intCrc = i;
+			for (int k = 0; k < 8; k++)
+				intCrc = (intCrc >> 1) ^ ((intCrc & 1) ? CRC32C_POLYNOMIAL : 0);
+			arrCrcTable[i] = intCrc;
+		}
+	}
+} crcTableInit;
+
+static unsigned int Crc32cTable(const unsigned char* pData, size_t intLength, unsigned int intCrc)
+{
+	for (size_t i = 0; i < intLength; i++)
+		intCrc = arrCrcTable[(intCrc ^ pData[i]) & 0xFF] ^ (intCrc >> 8);
+	return intCrc;
+}
+//===========================================================================
+//===========================================================================
+
+#ifdef CHECKSUM_SSE42
+//===========================================================================
+//===========================================================================
+static bool HasSSE42()
+{
+#ifdef _MSC_VER
+	int arrInfo[4];
+	__cpuid(arrInfo, 1);
+	return (arrInfo[2] & (1 << 20)) != 0;
+#else
+	unsigned int a, b, c, d;
+	return __get_cpuid(1, &a, &b, &c, &d) != 0 && (c & bit_SSE4_2) != 0;
+#endif
+}
+
+static const bool boolHasSSE42 = HasSSE42();
+
+CHECKSUM_TARGET static unsigned int Crc32cSSE42(const unsigned char* pData, size_t intLength, unsigned int intCrc)
+{
+	size_t i = 0;
+#if defined(_M_X64) || defined(__x86_64__)
+	unsigned long long intCrc64 = intCrc;
+	for (; i + 8 <= intLength; i += 8)
+	{
+		unsigned long long intWord;
+		memcpy(&intWord, pData + i, sizeof(intWord));
+		intCrc64 = _mm_crc32_u64(intCrc64, intWord);
+	}
+	intCrc = (unsigned int)intCrc64;
+#else
+	for (; i + 4 <= intLength; i += 4)
+	{
+		unsigned int intWord;
+		memcpy(&intWord, pData + i, sizeof(intWord));
+		intCrc = _mm_crc32_u32(intCrc, intWord);
+	}
+#endif
+	for (; i < intLength; i++)
+		intCrc = _mm_crc32_u8(intCrc, pData[i]);
+	return intCrc;
+}
+//===========================================================================
+//===========================================================================
+#endif
+
+//===========================================================================
+//===========================================================================
+unsigned int Crc32c(const unsigned char* pData, size_t intLength, unsigned int intCrc)
+{
+	intCrc = ~intCrc;
+#ifdef CHECKSUM_SSE42
+	if (boolHasSSE42)
+		return ~Crc32cSSE42(pData, intLength, intCrc);
+#endif
+	return ~Crc32cTable(pData, intLength, intCrc);
+}
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,45 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Checksum. CRC32C of byte buffers
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __CHECKSUM__H__
+#define __CHECKSUM__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <stddef.h>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- CRC32C (Castagnoli polynomial, as in iSCSI and ext4), which SSE4.2
+computes in hardware at 8 bytes per instruction. Whether the CPU has SSE4.2
+is checked once at startup; without it a table-driven loop gives the same
+values.
+
+- Crc32c(p, n, crc) continues a previous result, so Crc32c(b, m,
+Crc32c(a, n)) equals the CRC of a followed by b. Start with 0.
+
+*/
+
+//===========================================================================
+//===========================================================================
+unsigned int Crc32c(const unsigned char* pData, size_t intLength, unsigned int intCrc = 0);
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,319 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Codec. In-memory encode and decode
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "Codec.h"
+#include "Pyramid.h"
+#include "Checksum.h"
+#include "ThreadPool.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+//===========================================================================
+//===========================================================================
+
+/*
+ * In-memory API (Codec.h). Pixels are copied once into the image the encoder
+ * works on, and the decoded image once into the caller's rows; compressed
+ * bytes are gathered straight into, and parsed straight from, caller memory.
+ */
+int OptionsFrom(const Up2BestOptions* api, CodecOptions& options) {
+	if (api == nullptr) {
+		return UP2BEST_OK;
+	}
+	if (api->intQuantStep > MAX_QUANT_STEP || api->intRatio == 1) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	if (api->intQuantStep > 1) {
+		options.quantSteps.assign(1, api->intQuantStep);
+	}
+	options.predictor = api->boolPredict ? PREDICT_MED : PREDICT_NONE;
+	options.bitPlanes = api->boolLayers ? 1 : 0;
+	options.transform = api->boolWavelet ? TRANSFORM_WAVELET53 : TRANSFORM_LANCZOS3;
+	if (api->intRatio != 0) {
+		options.ratio = api->intRatio;
+	}
+	return UP2BEST_OK;
+}
+
+int EncodePixels(const unsigned char* pixels, unsigned int width, unsigned int height, size_t stride, 
+		const Up2BestOptions* api, std::unique_ptr<Pyramid>& p, const std::atomic<bool>* cancel = nullptr) {
+	CodecOptions options;
+	if (pixels == nullptr || width == 0 || height == 0 || width > INT_MAX || height > INT_MAX || stride < width) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	int status = OptionsFrom(api, options);
+	if (status != UP2BEST_OK) {
+		return status;
+	}
+	std::unique_ptr<KImage> image(new KImage(width, height, SIZE_UCHAR));
+	for (unsigned int i = 0; i < height; i++) {
+		std::memcpy(image->GetDataMatrix()[i], pixels + i * stride, width);
+	}
+	p.reset(Compress(image.get(), options, nullptr, cancel));
+	return p ? UP2BEST_OK : UP2BEST_CANCELLED;
+}
+
+void CopyContainer(Pyramid* p, const Container& c, unsigned char* out) {
+	std::vector<WriteBuffer> buffers = ContainerBuffers(p, c, nullptr);
+	for (size_t i = 0; i < buffers.size(); i++) {
+		std::memcpy(out, buffers[i].pData, buffers[i].intSize);
+		out += buffers[i].intSize;
+	}
+}
+
+extern "C" void Up2Best_DefaultOptions(Up2BestOptions* pOptions) {
+	if (pOptions != nullptr) {
+		pOptions->intQuantStep = 1;
+		pOptions->boolPredict = 0;
+		pOptions->boolLayers = 0;
+		pOptions->boolWavelet = 0;
+		pOptions->intRatio = 0;
+	}
+}
+
+extern "C" int Up2Best_Encode(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+		const Up2BestOptions* pOptions, unsigned char* pOut, size_t intCapacity, size_t* pSize) {
+	if (pSize == nullptr || (pOut == nullptr && intCapacity != 0)) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	try {
+		std::unique_ptr<Pyramid> p;
+		int status = EncodePixels(pPixels, intWidth, intHeight, intStride, pOptions, p);
+		if (status != UP2BEST_OK) {
+			return status;
+		}
+		Container c = BuildContainer(p.get());
+		*pSize = (size_t)c.fileSize;
+		if (c.fileSize > intCapacity) {
+			return UP2BEST_BUFFER_TOO_SMALL;
+		}
+		CopyContainer(p.get(), c, pOut);
+		return UP2BEST_OK;
+	}
+	catch (const std::bad_alloc&) {
+		return UP2BEST_OUT_OF_MEMORY;
+	}
+	catch (...) {
+		return UP2BEST_ERROR;
+	}
+}
+
+extern "C" int Up2Best_EncodeAlloc(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+		const Up2BestOptions* pOptions, unsigned char** ppOut, size_t* pSize) {
+	if (ppOut == nullptr || pSize == nullptr) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	*ppOut = nullptr;
+	try {
+		std::unique_ptr<Pyramid> p;
+		int status = EncodePixels(pPixels, intWidth, intHeight, intStride, pOptions, p);
+		if (status != UP2BEST_OK) {
+			return status;
+		}
+		Container c = BuildContainer(p.get());
+		unsigned char* out = (unsigned char*)std::malloc((size_t)c.fileSize);
+		if (out == nullptr) {
+			return UP2BEST_OUT_OF_MEMORY;
+		}
+		CopyContainer(p.get(), c, out);
+		*ppOut = out;
+		*pSize = (size_t)c.fileSize;
+		return UP2BEST_OK;
+	}
+	catch (const std::bad_alloc&) {
+		return UP2BEST_OUT_OF_MEMORY;
+	}
+	catch (...) {
+		return UP2BEST_ERROR;
+	}
+}
+
+extern "C" void Up2Best_Free(unsigned char* pData) {
+	std::free(pData);
+}
+
+std::pair<unsigned int, unsigned int> LevelDims(Pyramid* p, unsigned int level) {
+	auto dims = p->GetDims();
+	for (unsigned int i = 0; i < level; i++) {
+		dims = std::make_pair(p->Downsample(dims.first), p->Downsample(dims.second));
+	}
+	return dims;
+}
+
+/*
+ * Stored checksums are checked before decoding; the image checksum only
+ * covers the full image, so it is checked on full decodes.
+ */
+int DecodePixels(const unsigned char* data, size_t size, unsigned int level, unsigned char* out, size_t stride, 
+		const std::atomic<bool>* cancel = nullptr) {
+	if (data == nullptr || out == nullptr) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	std::unique_ptr<ResidualPyramid> p(ParseCompressed(data, size));
+	if (!p) {
+		return UP2BEST_CORRUPT;
+	}
+	p->SetBorrowed();
+	if (level > p->GetNumLevels()) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	auto dims = LevelDims(p.get(), level);
+	if (stride < dims.first) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	if (p->HasChecksums()) {
+		for (unsigned int i = 0; i < p->GetNumSegments(); i++) {
+			const Segment& segment = p->GetSegment(i);
+			if (Crc32c(segment.data, segment.compressedSize) != segment.checksum) {
+				return UP2BEST_CORRUPT;
+			}
+		}
+	}
+	std::unique_ptr<KImage> image(Decompress(p.get(), MAX_UCHAR, level, cancel));
+	if (!image) {
+		return Cancelled(cancel) ? UP2BEST_CANCELLED : UP2BEST_CORRUPT;
+	}
+	if ((unsigned int)image->GetWidth() != dims.first || (unsigned int)image->GetHeight() != dims.second ||
+		(level == 0 && p->HasChecksums() && ImageChecksum(image.get()) != p->GetImageChecksum())) {
+		return UP2BEST_CORRUPT;
+	}
+	for (unsigned int i = 0; i < dims.second; i++) {
+		std::memcpy(out + i * stride, image->GetDataMatrix()[i], dims.first);
+	}
+	return UP2BEST_OK;
+}
+
+extern "C" int Up2Best_GetLevelInfo(const unsigned char* pData, size_t intSize, unsigned int intLevel, 
+		unsigned int* pWidth, unsigned int* pHeight, unsigned int* pNumLevels) {
+	if (pWidth == nullptr || pHeight == nullptr) {
+		return UP2BEST_INVALID_ARGUMENT;
+	}
+	try {
+		std::unique_ptr<ResidualPyramid> p(ParseCompressed(pData, intSize));
+		if (!p) {
+			return UP2BEST_CORRUPT;
+		}
+		p->SetBorrowed();
+		if (pNumLevels != nullptr) {
+			*pNumLevels = p->GetNumLevels();
+		}
+		if (intLevel > p->GetNumLevels()) {
+			return UP2BEST_INVALID_ARGUMENT;
+		}
+		auto dims = LevelDims(p.get(), intLevel);
+		*pWidth = dims.first;
+		*pHeight = dims.second;
+		return UP2BEST_OK;
+	}
+	catch (const std::bad_alloc&) {
+		return UP2BEST_OUT_OF_MEMORY;
+	}
+	catch (...) {
+		return UP2BEST_ERROR;
+	}
+}
+
+extern "C" int Up2Best_GetInfo(const unsigned char* pData, size_t intSize, unsigned int* pWidth, unsigned int* pHeight) {
+	return Up2Best_GetLevelInfo(pData, intSize, 0, pWidth, pHeight, nullptr);
+}
+
+extern "C" int Up2Best_DecodeLevel(const unsigned char* pData, size_t intSize, unsigned int intLevel, 
+		unsigned char* pOut, size_t intStride) {
+	try {
+		return DecodePixels(pData, intSize, intLevel, pOut, intStride);
+	}
+	catch (const std::bad_alloc&) {
+		return UP2BEST_OUT_OF_MEMORY;
+	}
+	catch (...) {
+		return UP2BEST_ERROR;
+	}
+}
+
+extern "C" int Up2Best_Decode(const unsigned char* pData, size_t intSize, unsigned char* pOut, size_t intStride) {
+	return Up2Best_DecodeLevel(pData, intSize, 0, pOut, intStride);
+}
+
+int EncodeToBuffer(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+		std::vector<unsigned char>& vecOut, const Up2BestOptions* pOptions, const std::atomic<bool>* pCancel) {
+	try {
+		std::unique_ptr<Pyramid> p;
+		int status = EncodePixels(pPixels, intWidth, intHeight, intStride, pOptions, p, pCancel);
+		if (status != UP2BEST_OK) {
+			return status;
+		}
+		Container c = BuildContainer(p.get());
+		size_t first = vecOut.size();
+		vecOut.resize(first + (size_t)c.fileSize);
+		CopyContainer(p.get(), c, vecOut.data() + first);
+		return UP2BEST_OK;
+	}
+	catch (const std::bad_alloc&) {
+		return UP2BEST_OUT_OF_MEMORY;
+	}
+	catch (...) {
+		return UP2BEST_ERROR;
+	}
+}
+
+int DecodeToBuffer(const unsigned char* pData, size_t intSize, unsigned char* pOut, size_t intStride, unsigned int intLevel) {
+	return Up2Best_DecodeLevel(pData, intSize, intLevel, pOut, intStride);
+}
+
+/*
+ * Async jobs run on CodecPool, whose threads also take the row bands and
+ * level chains of the jobs running on it, so that any number of jobs keeps
+ * to one thread per core. A job waits for nothing but its own items, which
+ * it runs itself when every other thread is busy.
+ */
+template <typename F>
+std::future<int> RunAsync(const CodecCancel& cancel, F job) {
+	auto task = std::make_shared<std::packaged_task<int()>>([cancel, job]() -> int {
+		// Jobs cancelled while queued never start
+		if (cancel.IsCancelled()) {
+			return UP2BEST_CANCELLED;
+		}
+		try {
+			return job(cancel.GetFlag());
+		}
+		catch (const std::bad_alloc&) {
+			return UP2BEST_OUT_OF_MEMORY;
+		}
+		catch (...) {
+			return UP2BEST_ERROR;
+		}
+	});
+	std::future<int> result = task->get_future();
+	CodecPool().Submit([task]() { (*task)(); });
+	return result;
+}
+
+std::future<int> EncodeAsync(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+		std::vector<unsigned char>& vecOut, const Up2BestOptions* pOptions, const CodecCancel& cancel) {
+	std::vector<unsigned char>* out = &vecOut;
+	bool hasOptions = pOptions != nullptr;
+	Up2BestOptions options;
+	Up2Best_DefaultOptions(&options);
+	if (hasOptions) {
+		options = *pOptions;
+	}
+	return RunAsync(cancel, [=](const std::atomic<bool>* flag) {
+		return EncodeToBuffer(pPixels, intWidth, intHeight, intStride, *out, hasOptions ? &options : nullptr, flag);
+	});
+}
+
+std::future<int> DecodeAsync(const unsigned char* pData, size_t intSize, unsigned char* pOut, size_t intStride, 
+		const CodecCancel& cancel, unsigned int intLevel) {
+	return RunAsync(cancel, [=](const std::atomic<bool>* flag) {
+		return DecodePixels(pData, intSize, intLevel, pOut, intStride, flag);
+	});
+}
@@ -0,0 +1,180 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Codec. In-memory encode and decode
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __CODEC__H__
+#define __CODEC__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <stddef.h>
+#ifdef __cplusplus
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <future>
+#endif
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- Encodes 8-bit grayscale pixels to the bytes of a .pyr file and decodes
+them back, entirely in memory: nothing here opens, reads or writes a file
+or calls the FreeImage loaders and savers.
+
+- Pixels are rows of width bytes, stride bytes apart; stride may be larger
+than width so that rows of a bigger buffer can be passed in place.
+
+- Up2Best_Encode writes into caller memory. If the buffer is too small it
+returns UP2BEST_BUFFER_TOO_SMALL with *pSize set to the bytes needed;
+Up2Best_EncodeAlloc allocates a buffer of the exact size instead, to be
+released with Up2Best_Free.
+
+- Up2Best_Decode parses the compressed bytes where they are, without
+copying the segments, and writes Up2Best_GetInfo width x height pixels into
+caller memory. Truncated layered data decodes from the layers that arrived.
+
+- Up2Best_DecodeLevel stops at a pyramid level, 0 being the full image and
+the level count from Up2Best_GetLevelInfo the stored top image, and writes
+that level's smaller image; the finer levels are never reconstructed, which
+makes previews cheap.
+
+- The C functions never throw; they return one of the UP2BEST_ codes, and
+UP2BEST_ERROR for any failure none of the others describes. Damaged or
+foreign data gives UP2BEST_CORRUPT. The C++ wrappers below them return the
+same codes; EncodeToBuffer appends the compressed bytes to vecOut.
+
+- EncodeAsync and DecodeAsync queue the same work on a shared pool of
+worker threads and return at once; the future yields the status code. The
+pool has one thread per core, and the row bands and levels of a running job
+are spread over the same threads, so queuing many jobs does not multiply
+the threads. The pixels, compressed data and output buffers must stay valid
+and untouched until the future is ready.
+
+- Cancel on a CodecCancel (or any copy of it) makes a queued job return
+UP2BEST_CANCELLED without starting, and a running one give up at its next
+check: between pyramid levels, between row bands of a level's
+reconstruction, and after every megabyte that bzip2 compresses or inflates.
+The work between two checks, such as computing the residuals of one
+encoder level, runs to its end. A job that already finished is not affected.
+
+- The functions live in the up2bestcodec static library (Up2BestCodec.lib
+with Visual Studio), which brings bzip2 along. Images are still held in
+KImage while they are coded, so the FreeImage library must be linked too,
+although no image file format is involved.
+
+*/
+
+//===========================================================================
+//===========================================================================
+#define UP2BEST_OK					0
+#define UP2BEST_INVALID_ARGUMENT	1
+#define UP2BEST_BUFFER_TOO_SMALL	2
+#define UP2BEST_CORRUPT				3
+#define UP2BEST_OUT_OF_MEMORY		4
+#define UP2BEST_CANCELLED			5
+#define UP2BEST_ERROR				6
+//===========================================================================
+//===========================================================================
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//===========================================================================
+//===========================================================================
+typedef struct Up2BestOptions
+{
+	unsigned char intQuantStep;		// 1 is lossless, up to 64
+	unsigned char boolPredict;		// MED prediction of the residuals
+	unsigned char boolLayers;		// bit-plane layers, decodable from any prefix
+	unsigned char boolWavelet;		// 5/3 wavelet instead of the Lanczos3 pyramid
+	unsigned char intRatio;			// pyramid downsampling ratio, 0 for the default
+} Up2BestOptions;
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void Up2Best_DefaultOptions(Up2BestOptions* pOptions);
+int Up2Best_Encode(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+	const Up2BestOptions* pOptions, unsigned char* pOut, size_t intCapacity, size_t* pSize);
+int Up2Best_EncodeAlloc(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+	const Up2BestOptions* pOptions, unsigned char** ppOut, size_t* pSize);
+void Up2Best_Free(unsigned char* pData);
+int Up2Best_GetInfo(const unsigned char* pData, size_t intSize, unsigned int* pWidth, unsigned int* pHeight);
+int Up2Best_GetLevelInfo(const unsigned char* pData, size_t intSize, unsigned int intLevel,
+	unsigned int* pWidth, unsigned int* pHeight, unsigned int* pNumLevels);
+int Up2Best_Decode(const unsigned char* pData, size_t intSize, unsigned char* pOut, size_t intStride);
+int Up2Best_DecodeLevel(const unsigned char* pData, size_t intSize, unsigned int intLevel,
+	unsigned char* pOut, size_t intStride);
+//===========================================================================
+//===========================================================================
+
+#ifdef __cplusplus
+}
+
+//===========================================================================
+//===========================================================================
+// Copies share one flag, so the job and the caller can each hold one
+class CodecCancel
+{
+private:
+	std::shared_ptr<std::atomic<bool>> pFlag;
+
+public:
+	CodecCancel() : pFlag(std::make_shared<std::atomic<bool>>(false)) {}
+
+	//===========================================================================
+	//===========================================================================
+	void Cancel()
+	{
+		pFlag->store(true);
+	}
+
+	//===========================================================================
+	//===========================================================================
+	bool IsCancelled() const
+	{
+		return pFlag->load();
+	}
+
+	//===========================================================================
+	//===========================================================================
+	const std::atomic<bool>* GetFlag() const
+	{
+		return pFlag.get();
+	}
+};
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+int EncodeToBuffer(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+	std::vector<unsigned char>& vecOut, const Up2BestOptions* pOptions = NULL, const std::atomic<bool>* pCancel = NULL);
+int DecodeToBuffer(const unsigned char* pData, size_t intSize, unsigned char* pOut, size_t intStride,
+	unsigned int intLevel = 0);
+std::future<int> EncodeAsync(const unsigned char* pPixels, unsigned int intWidth, unsigned int intHeight, size_t intStride,
+	std::vector<unsigned char>& vecOut, const Up2BestOptions* pOptions = NULL, const CodecCancel& cancel = CodecCancel());
+std::future<int> DecodeAsync(const unsigned char* pData, size_t intSize, unsigned char* pOut, size_t intStride,
+	const CodecCancel& cancel = CodecCancel(), unsigned int intLevel = 0);
+//===========================================================================
+//===========================================================================
+#endif
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
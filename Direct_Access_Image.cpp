@@ -15,13 +15,15 @@
 
 //===========================================================================
 //===========================================================================
+#ifdef _MSC_VER
 #pragma comment(lib, "./FreeImage/FreeImage.lib")
+#endif
 //===========================================================================
 //===========================================================================
 
 //===========================================================================
 //===========================================================================
-void KImage::SaveAs(const TCHAR *strFileName, unsigned intFormatType)
+bool KImage::SaveAs(const TCHAR *strFileName, unsigned intFormatType)
 {
 	static int flag_vect[] =
 	{
@@ -75,15 +77,15 @@ void KImage::SaveAs(const TCHAR *strFileName, unsigned intFormatType)
 	assert(intFormatType < SAVE_NO_FORMAT);
 	// check for incorrect parameter
 	if (intFormatType >= SAVE_NO_FORMAT)
-		return;
+		return false;
 
 	int flag = flag_vect[intFormatType];
 	FREE_IMAGE_FORMAT fif = format_vect[intFormatType];
 
-	BOOL res;
 	WORD bpp = WORD(FreeImage_GetBPP(this->fbit));
-	if (FreeImage_FIFSupportsWriting(fif) && FreeImage_FIFSupportsExportBPP(fif, bpp))
-		res = FreeImage_Save_Wrapper(fif, this->fbit, strFileName, flag);
+	if (!FreeImage_FIFSupportsWriting(fif) || !FreeImage_FIFSupportsExportBPP(fif, bpp))
+		return false;
+	return FreeImage_Save_Wrapper(fif, this->fbit, strFileName, flag) != FALSE;
 }
 //===========================================================================
 //===========================================================================
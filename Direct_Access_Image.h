@@ -16,6 +16,7 @@
 //===========================================================================
 //===========================================================================
 #include "./FreeImage/FreeImage.h"
+#include "FileScan.h"
 //===========================================================================
 //===========================================================================
 
@@ -29,7 +30,7 @@
 
 //===========================================================================
 //===========================================================================
-#ifdef _UNICODE
+#if defined(_UNICODE) && defined(_WIN32)
 inline FIBITMAP* FreeImage_Load_Wrapper(FREE_IMAGE_FORMAT fif, const _TCHAR* fileName, int flags = 0)
 {
 	return FreeImage_LoadU(fif, fileName, flags);
@@ -49,6 +50,28 @@ inline BOOL FreeImage_Save_Wrapper(FREE_IMAGE_FORMAT fif, FIBITMAP *dib, const _
 {
 	return FreeImage_SaveU(fif, dib, fileName, flags);
 }
+#elif defined(_UNICODE)
+// FreeImage takes wide file names only on Windows; elsewhere they are narrowed
+// with the current locale, as FileScan does
+inline FIBITMAP* FreeImage_Load_Wrapper(FREE_IMAGE_FORMAT fif, const _TCHAR* fileName, int flags = 0)
+{
+	return FreeImage_Load(fif, NarrowPath(fileName).c_str(), flags);
+}
+
+inline FREE_IMAGE_FORMAT FreeImage_GetFIFFromFilename_Wrapper(const _TCHAR* fileName)
+{
+	return FreeImage_GetFIFFromFilename(NarrowPath(fileName).c_str());
+}
+
+inline FREE_IMAGE_FORMAT FreeImage_GetFileType_Wrapper(const _TCHAR* fileName, int size = 0)
+{
+	return FreeImage_GetFileType(NarrowPath(fileName).c_str(), size);
+}
+
+inline BOOL FreeImage_Save_Wrapper(FREE_IMAGE_FORMAT fif, FIBITMAP *dib, const _TCHAR* fileName, int flags = 0)
+{
+	return FreeImage_Save(fif, dib, NarrowPath(fileName).c_str(), flags);
+}
 #else
 inline FIBITMAP* FreeImage_Load_Wrapper(FREE_IMAGE_FORMAT fif, const _TCHAR* fileName, int flags=0)
 {
@@ -307,6 +330,28 @@ public:
 		}
 	}
 
+	//===========================================================================
+	//===========================================================================
+	// Reads the dimensions of an image file without decoding its pixels (for
+	// plugins that cannot skip them FreeImage loads the whole image)
+	static bool ReadHeader(const TCHAR *strFileName, int& intSizeX, int& intSizeY, int& intBPP)
+	{
+		FREE_IMAGE_FORMAT fif = FreeImage_GetFileType_Wrapper(strFileName, 0);
+		if (fif == FIF_UNKNOWN)
+			fif = FreeImage_GetFIFFromFilename_Wrapper(strFileName);
+		if (fif == FIF_UNKNOWN || !FreeImage_FIFSupportsReading(fif))
+			return false;
+
+		FIBITMAP* pHeader = FreeImage_Load_Wrapper(fif, strFileName, FIF_LOAD_NOPIXELS);
+		if (pHeader == NULL)
+			return false;
+		intSizeX = FreeImage_GetWidth(pHeader);
+		intSizeY = FreeImage_GetHeight(pHeader);
+		intBPP = FreeImage_GetBPP(pHeader);
+		FreeImage_Unload(pHeader);
+		return intSizeX > 0 && intSizeY > 0;
+	}
+
 	//===========================================================================
 	//===========================================================================
 	~KImage()
@@ -349,8 +394,6 @@ public:
 	//===========================================================================
 	bool IsValid()
 	{
-		if (this == NULL)
-			return false;
 		if (!boolIsValid)
 			return false;
 		if (intWidth <= 0 || intHeight <= 0 || (intBPP != 1 && intBPP != 8 && intBPP != 24))
@@ -596,7 +639,8 @@ public:
 
 	//===========================================================================
 	//===========================================================================
-	void SaveAs(const TCHAR *strFileName, unsigned intFormatType = SAVE_TIFF_DEFAULT);
+	// Returns false if the format cannot be written or FreeImage fails to save
+	bool SaveAs(const TCHAR *strFileName, unsigned intFormatType = SAVE_TIFF_DEFAULT);
 	//===========================================================================
 	//===========================================================================
 	void Crop(int top, int bottom, int left, int right);
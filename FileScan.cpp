@@ -0,0 +1,221 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  FileScan. Portable directory walking and glob matching
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "FileScan.h"
+
+#include <algorithm>
+#include <cwctype>
+
+#ifdef _WIN32
+#include <io.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdlib.h>
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+bool MatchGlob(const std::wstring& strName, const std::wstring& strPattern)
+{
+	// Greedy matching with backtracking to the last *
+	size_t n = 0, p = 0;
+	size_t intStar = std::wstring::npos, intResume = 0;
+	while (n < strName.size())
+	{
+		if (p < strPattern.size() && (strPattern[p] == L'?' ||
+			std::towlower(strPattern[p]) == std::towlower(strName[n])))
+		{
+			n++;
+			p++;
+		}
+		else if (p < strPattern.size() && strPattern[p] == L'*')
+		{
+			intStar = p++;
+			intResume = n;
+		}
+		else if (intStar != std::wstring::npos)
+		{
+			p = intStar + 1;
+			n = ++intResume;
+		}
+		else
+			return false;
+	}
+	while (p < strPattern.size() && strPattern[p] == L'*')
+		p++;
+	return p == strPattern.size();
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+std::wstring JoinPath(const std::wstring& strDirectory, const std::wstring& strName)
+{
+	if (strDirectory.empty())
+		return strName;
+	if (strName.empty())
+		return strDirectory;
+	wchar_t chLast = strDirectory[strDirectory.size() - 1];
+	if (chLast == L'/' || chLast == L'\\')
+		return strDirectory + strName;
+	return strDirectory + PATH_SEPARATOR + strName;
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+std::wstring ReplaceExtension(const std::wstring& strPath, const std::wstring& strExtension)
+{
+	size_t intDot = strPath.rfind(L'.');
+	size_t intSlash = strPath.find_last_of(L"/\\");
+	if (intDot == std::wstring::npos || (intSlash != std::wstring::npos && intDot < intSlash))
+		return strPath + L"." + strExtension;
+	return strPath.substr(0, intDot + 1) + strExtension;
+}
+//===========================================================================
+//===========================================================================
+
+#ifndef _WIN32
+/*
+ *
+ *    POSIX helpers
+ *
+ *    File names are bytes on Linux; they are converted to and from the wide
+ *    strings the rest of the program uses with the current locale.
+ *
+ */
+//===========================================================================
+//===========================================================================
+static std::string Narrow(const std::wstring& strWide)
+{
+	std::vector<char> buffer(strWide.size() * MB_CUR_MAX + 1);
+	size_t intLength = wcstombs(&buffer[0], strWide.c_str(), buffer.size());
+	return intLength == (size_t)-1 ? std::string() : std::string(&buffer[0], intLength);
+}
+
+static std::wstring Widen(const char* strNarrow)
+{
+	std::vector<wchar_t> buffer(strlen(strNarrow) + 1);
+	size_t intLength = mbstowcs(&buffer[0], strNarrow, buffer.size());
+	return intLength == (size_t)-1 ? std::wstring() : std::wstring(&buffer[0], intLength);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+std::string NarrowPath(const std::wstring& strPath)
+{
+	return Narrow(strPath);
+}
+
+std::wstring WidePath(const char* strPath)
+{
+	return Widen(strPath);
+}
+//===========================================================================
+//===========================================================================
+#endif
+
+//===========================================================================
+//===========================================================================
+static void ScanInto(const std::wstring& strRoot, const std::wstring& strRelative, const std::wstring& strPattern,
+	bool boolRecursive, std::vector<std::wstring>& vecFiles)
+{
+	std::vector<std::wstring> vecSubdirectories;
+	std::wstring strDirectory = JoinPath(strRoot, strRelative);
+#ifdef _WIN32
+	_wfinddata_t findData;
+	intptr_t handle = _wfindfirst(JoinPath(strDirectory, L"*").c_str(), &findData);
+	if (handle == -1)
+		return;
+	do
+	{
+		std::wstring strName(findData.name);
+		if (strName == L"." || strName == L"..")
+			continue;
+		if ((findData.attrib & _A_SUBDIR) != 0)
+			vecSubdirectories.push_back(strName);
+		else if (MatchGlob(strName, strPattern))
+			vecFiles.push_back(JoinPath(strRelative, strName));
+	} while (_wfindnext(handle, &findData) == 0);
+	_findclose(handle);
+#else
+	std::string strNarrow = Narrow(strDirectory);
+	DIR* pDir = opendir(strNarrow.c_str());
+	if (pDir == NULL)
+		return;
+	while (dirent* pEntry = readdir(pDir))
+	{
+		std::wstring strName = Widen(pEntry->d_name);
+		if (strName.empty() || strName == L"." || strName == L"..")
+			continue;
+		struct stat info;
+		if (stat((strNarrow + "/" + pEntry->d_name).c_str(), &info) != 0)
+			continue;
+		if (S_ISDIR(info.st_mode))
+			vecSubdirectories.push_back(strName);
+		else if (S_ISREG(info.st_mode) && MatchGlob(strName, strPattern))
+			vecFiles.push_back(JoinPath(strRelative, strName));
+	}
+	closedir(pDir);
+#endif
+	if (!boolRecursive)
+		return;
+	std::sort(vecSubdirectories.begin(), vecSubdirectories.end());
+	for (size_t i = 0; i < vecSubdirectories.size(); i++)
+		ScanInto(strRoot, JoinPath(strRelative, vecSubdirectories[i]), strPattern, boolRecursive, vecFiles);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+std::vector<std::wstring> ScanDirectory(const std::wstring& strRoot, const std::wstring& strPattern, bool boolRecursive)
+{
+	std::vector<std::wstring> vecFiles;
+	ScanInto(strRoot, L"", strPattern, boolRecursive, vecFiles);
+	std::sort(vecFiles.begin(), vecFiles.end());
+	return vecFiles;
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+bool MakeDirectories(const std::wstring& strPath)
+{
+	for (size_t i = 1; i <= strPath.size(); i++)
+	{
+		if (i != strPath.size() && strPath[i] != L'/' && strPath[i] != L'\\')
+			continue;
+		std::wstring strPrefix = strPath.substr(0, i);
+		if (strPrefix.empty() || strPrefix[strPrefix.size() - 1] == L':')
+			continue;
+#ifdef _WIN32
+		if (_wmkdir(strPrefix.c_str()) != 0 && errno != EEXIST)
+			return false;
+#else
+		if (mkdir(Narrow(strPrefix).c_str(), 0777) != 0 && errno != EEXIST)
+			return false;
+#endif
+	}
+	return true;
+}
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,80 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  FileScan. Portable directory walking and glob matching
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __FILESCAN__H__
+#define __FILESCAN__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <string>
+#include <vector>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- ScanDirectory lists the files under a root whose name matches a glob
+pattern, optionally descending into subdirectories. Paths are returned
+relative to the root, so that an output tree can mirror the input tree, and
+sorted, so that a batch visits files in the same order on every file system.
+
+- Patterns support * (any run of characters) and ? (one character) and are
+matched case-insensitively against the file name only, as the Windows shell
+does; *.tif matches both scan.TIF and scan.tif on Linux.
+
+- The Windows build walks with _wfindfirst, everything else with opendir and
+readdir; wide paths are converted with the current locale there, and
+StreamPath gives the form the fstream constructors accept on each.
+
+*/
+
+//===========================================================================
+//===========================================================================
+#ifdef _WIN32
+#define PATH_SEPARATOR		L'\\'
+#else
+#define PATH_SEPARATOR		L'/'
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+bool MatchGlob(const std::wstring& strName, const std::wstring& strPattern);
+std::vector<std::wstring> ScanDirectory(const std::wstring& strRoot, const std::wstring& strPattern, bool boolRecursive);
+std::wstring JoinPath(const std::wstring& strDirectory, const std::wstring& strName);
+std::wstring ReplaceExtension(const std::wstring& strPath, const std::wstring& strExtension);
+bool MakeDirectories(const std::wstring& strPath);
+#ifdef _WIN32
+// File names as the fstream constructors take them
+inline const std::wstring& StreamPath(const std::wstring& strPath)
+{
+	return strPath;
+}
+#else
+std::string NarrowPath(const std::wstring& strPath);
+std::wstring WidePath(const char* strPath);
+
+inline std::string StreamPath(const std::wstring& strPath)
+{
+	return NarrowPath(strPath);
+}
+#endif
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,189 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  FileWriter. Gathered, atomic file writes
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "FileWriter.h"
+#include "FileScan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdio.h>
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef IOV_MAX
+#define IOV_MAX				1024
+#endif
+
+// Names tried when a temporary file of this process is left over from a crash
+#define TEMP_ATTEMPTS		16
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static std::atomic<unsigned int> intTempCounter(0);
+
+template <typename String>
+static String TempName(const String& strTarget, unsigned long intProcess)
+{
+	std::basic_ostringstream<typename String::value_type> stream;
+	stream << strTarget << '.' << intProcess << '.' << intTempCounter++ << ".tmp";
+	return stream.str();
+}
+//===========================================================================
+//===========================================================================
+
+#ifdef _WIN32
+//===========================================================================
+//===========================================================================
+bool WriteFileGathered(const std::wstring& strFile, const std::vector<WriteBuffer>& vecBuffers, bool boolSync)
+{
+	std::wstring strTemp;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	for (int i = 0; i < TEMP_ATTEMPTS && hFile == INVALID_HANDLE_VALUE; i++)
+	{
+		strTemp = TempName(strFile, GetCurrentProcessId());
+		hFile = CreateFileW(strTemp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE && GetLastError() != ERROR_FILE_EXISTS)
+			return false;
+	}
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool boolOk = true;
+	for (size_t i = 0; boolOk && i < vecBuffers.size(); i++)
+	{
+		const char* pData = (const char*)vecBuffers[i].pData;
+		size_t intLeft = vecBuffers[i].intSize;
+		while (boolOk && intLeft != 0)
+		{
+			DWORD intChunk = (DWORD)std::min<size_t>(intLeft, 1u << 30);
+			DWORD intWritten = 0;
+			boolOk = WriteFile(hFile, pData, intChunk, &intWritten, NULL) != 0 && intWritten != 0;
+			pData += intWritten;
+			intLeft -= intWritten;
+		}
+	}
+	if (boolOk && boolSync)
+		boolOk = FlushFileBuffers(hFile) != 0;
+	boolOk = CloseHandle(hFile) != 0 && boolOk;
+	DWORD intFlags = MOVEFILE_REPLACE_EXISTING | (boolSync ? MOVEFILE_WRITE_THROUGH : 0);
+	if (!boolOk || !MoveFileExW(strTemp.c_str(), strFile.c_str(), intFlags))
+	{
+		DeleteFileW(strTemp.c_str());
+		return false;
+	}
+	return true;
+}
+//===========================================================================
+//===========================================================================
+#else
+//===========================================================================
+//===========================================================================
+static bool WriteAll(int intFile, std::vector<iovec>& vecIov)
+{
+	size_t intFirst = 0;
+	while (intFirst < vecIov.size())
+	{
+		int intCount = (int)std::min<size_t>(vecIov.size() - intFirst, IOV_MAX);
+		ssize_t intWritten = writev(intFile, &vecIov[intFirst], intCount);
+		if (intWritten < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		// Skip what went out, and resume a buffer that was written in part
+		size_t intDone = (size_t)intWritten;
+		while (intFirst < vecIov.size() && intDone >= vecIov[intFirst].iov_len)
+			intDone -= vecIov[intFirst++].iov_len;
+		if (intFirst < vecIov.size())
+		{
+			vecIov[intFirst].iov_base = (char*)vecIov[intFirst].iov_base + intDone;
+			vecIov[intFirst].iov_len -= intDone;
+		}
+	}
+	return true;
+}
+
+static void SyncDirectory(const std::string& strFile)
+{
+	size_t intSlash = strFile.rfind('/');
+	std::string strDirectory = intSlash == std::string::npos ? "." : strFile.substr(0, intSlash + 1);
+	int intDirectory = open(strDirectory.c_str(), O_RDONLY);
+	if (intDirectory >= 0)
+	{
+		fsync(intDirectory);
+		close(intDirectory);
+	}
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+bool WriteFileGathered(const std::wstring& strFile, const std::vector<WriteBuffer>& vecBuffers, bool boolSync)
+{
+	std::string strTarget = NarrowPath(strFile);
+	std::string strTemp;
+	int intFile = -1;
+	for (int i = 0; i < TEMP_ATTEMPTS && intFile < 0; i++)
+	{
+		strTemp = TempName(strTarget, (unsigned long)getpid());
+		intFile = open(strTemp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if (intFile < 0 && errno != EEXIST)
+			return false;
+	}
+	if (intFile < 0)
+		return false;
+
+	std::vector<iovec> vecIov;
+	vecIov.reserve(vecBuffers.size());
+	for (size_t i = 0; i < vecBuffers.size(); i++)
+	{
+		if (vecBuffers[i].intSize == 0)
+			continue;
+		iovec iov;
+		iov.iov_base = const_cast<void*>(vecBuffers[i].pData);
+		iov.iov_len = vecBuffers[i].intSize;
+		vecIov.push_back(iov);
+	}
+
+	bool boolOk = WriteAll(intFile, vecIov);
+	if (boolOk && boolSync)
+		boolOk = fsync(intFile) == 0;
+	boolOk = close(intFile) == 0 && boolOk;
+	if (!boolOk || rename(strTemp.c_str(), strTarget.c_str()) != 0)
+	{
+		unlink(strTemp.c_str());
+		return false;
+	}
+	if (boolSync)
+		SyncDirectory(strTarget);
+	return true;
+}
+//===========================================================================
+//===========================================================================
+#endif
@@ -0,0 +1,67 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  FileWriter. Gathered, atomic file writes
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __FILEWRITER__H__
+#define __FILEWRITER__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <string>
+#include <vector>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- WriteFileGathered writes a list of buffers, in order, as one file. The
+buffers are handed to the kernel as they are (writev, up to IOV_MAX at a
+time), so a header, a few rows and the compressed segments go out in one
+system call without being copied into a staging buffer first. Windows has no
+gathered write for buffered files; there each buffer is one WriteFile.
+
+- The data goes to a temporary file next to <file>, named after the process
+and a per-process counter (<file>.<pid>.<n>.tmp, created exclusively), so
+concurrent writers of the same target never share one. It is renamed over
+<file> only once it is complete, so a reader, or a crash of the process,
+sees either the old file or the new one, never a partial one.
+
+- That guarantee extends to a power loss or an OS crash only with boolSync:
+then the data is flushed to disk before the rename, and on POSIX the
+directory entry after it. Without boolSync the rename may reach the disk
+before the data, and the file can come back empty or truncated.
+
+- Returns false if anything failed; the temporary file is removed then.
+
+*/
+
+//===========================================================================
+//===========================================================================
+struct WriteBuffer
+{
+	const void* pData;
+	size_t intSize;
+};
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+bool WriteFileGathered(const std::wstring& strFile, const std::vector<WriteBuffer>& vecBuffers, bool boolSync);
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
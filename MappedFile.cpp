@@ -0,0 +1,115 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  MappedFile. Read-only memory mapping of a whole file
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "MappedFile.h"
+#include "FileScan.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+MappedFile::MappedFile() : pData(NULL), intSize(0)
+#ifdef _WIN32
+	, hFile(INVALID_HANDLE_VALUE), hMapping(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+bool MappedFile::Open(const std::wstring& strFile)
+{
+	Close();
+#ifdef _WIN32
+	hFile = CreateFileW(strFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+	{
+		Close();
+		return false;
+	}
+	pData = (const unsigned char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (pData == NULL)
+	{
+		Close();
+		return false;
+	}
+	intSize = size.QuadPart;
+#else
+	int intFile = open(NarrowPath(strFile).c_str(), O_RDONLY);
+	if (intFile < 0)
+		return false;
+	struct stat info;
+	if (fstat(intFile, &info) != 0 || info.st_size == 0)
+	{
+		close(intFile);
+		return false;
+	}
+	void* pMap = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, intFile, 0);
+	// The mapping keeps the file referenced on its own
+	close(intFile);
+	if (pMap == MAP_FAILED)
+		return false;
+	pData = (const unsigned char*)pMap;
+	intSize = info.st_size;
+#endif
+	return true;
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (pData != NULL)
+		UnmapViewOfFile(pData);
+	if (hMapping != NULL)
+		CloseHandle(hMapping);
+	if (hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(hFile);
+	hMapping = NULL;
+	hFile = INVALID_HANDLE_VALUE;
+#else
+	if (pData != NULL)
+		munmap((void*)pData, intSize);
+#endif
+	pData = NULL;
+	intSize = 0;
+}
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,81 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  MappedFile. Read-only memory mapping of a whole file
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __MAPPEDFILE__H__
+#define __MAPPEDFILE__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <string>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- Maps a file read-only into the address space (MapViewOfFile on Windows,
+mmap elsewhere). Opening costs a few system calls whatever the file size;
+pages are read from the page cache when they are first touched.
+
+- Pointers returned by GetData stay valid until the object is destroyed,
+so anything holding such pointers must hold the MappedFile as well.
+
+- Empty files cannot be mapped and fail to open.
+
+*/
+
+//===========================================================================
+//===========================================================================
+class MappedFile
+{
+private:
+	const unsigned char* pData;
+	unsigned long long intSize;
+#ifdef _WIN32
+	// HANDLEs, kept opaque so that this header does not pull in windows.h
+	void* hFile;
+	void* hMapping;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void Close();
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::wstring& strFile);
+
+	//===========================================================================
+	//===========================================================================
+	const unsigned char* GetData() const
+	{
+		return pData;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	unsigned long long GetSize() const
+	{
+		return intSize;
+	}
+};
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
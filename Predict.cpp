@@ -0,0 +1,216 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Predict. Spatial prediction of residual planes
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "Predict.h"
+
+#include <vector>
+#include <algorithm>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PREDICT_SSE2
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#define PREDICT_BIAS		128
+#define PREDICT_MASK		0xFF
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static inline int MedianPredictor(int a, int b, int bc)
+{
+	// median(a, b, a + b - c) == clamp(a + (b - c), min(a, b), max(a, b))
+	int intLow = std::min(a, b);
+	int intHigh = std::max(a, b);
+	return std::max(intLow, std::min(intHigh, a + bc));
+}
+//===========================================================================
+//===========================================================================
+
+/*
+ *
+ *    PredictMEDRow()
+ *
+ *    All neighbours are known on the encoder side, so the whole row is
+ *    predicted in parallel. Rows are padded with a leading zero so that
+ *    pPrev[x] is the upper-left and pPrev[x + 1] the upper neighbour.
+ *
+ */
+//===========================================================================
+//===========================================================================
+static void PredictMEDRow(const short* pPrev, const short* pCur, int intWidth, unsigned char* pCodes)
+{
+	int x = 0;
+#ifdef PREDICT_SSE2
+	const __m128i bias = _mm_set1_epi16(PREDICT_BIAS);
+	const __m128i mask = _mm_set1_epi16(PREDICT_MASK);
+	for (; x + 16 <= intWidth; x += 16)
+	{
+		__m128i lo, hi;
+		for (int intHalf = 0; intHalf < 2; intHalf++)
+		{
+			int intX = x + intHalf * 8;
+			__m128i c = _mm_loadu_si128((const __m128i*)(pPrev + intX));
+			__m128i b = _mm_loadu_si128((const __m128i*)(pPrev + intX + 1));
+			__m128i a = _mm_loadu_si128((const __m128i*)(pCur + intX));
+			__m128i r = _mm_loadu_si128((const __m128i*)(pCur + intX + 1));
+			__m128i p = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+			p = _mm_max_epi16(_mm_min_epi16(a, b), _mm_min_epi16(_mm_max_epi16(a, b), p));
+			__m128i e = _mm_and_si128(_mm_add_epi16(_mm_sub_epi16(r, p), bias), mask);
+			if (intHalf == 0)
+				lo = e;
+			else
+				hi = e;
+		}
+		_mm_storeu_si128((__m128i*)(pCodes + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < intWidth; x++)
+	{
+		int intPred = MedianPredictor(pCur[x], pPrev[x + 1], pPrev[x + 1] - pPrev[x]);
+		pCodes[x] = (unsigned char)((pCur[x + 1] - intPred + PREDICT_BIAS) & PREDICT_MASK);
+	}
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void PredictResiduals(const short* pResidual, int intWidth, int intHeight,
+	int intPredictor, unsigned char* pCodes)
+{
+	assert(intPredictor == PREDICT_MED);
+	(void)intPredictor;
+
+	std::vector<short> prev(intWidth + 1, 0);
+	std::vector<short> cur(intWidth + 1, 0);
+	for (int y = 0; y < intHeight; y++)
+	{
+		std::copy(pResidual + y * intWidth, pResidual + (y + 1) * intWidth, cur.begin() + 1);
+		PredictMEDRow(&prev[0], &cur[0], intWidth, pCodes + y * intWidth);
+		std::swap(prev, cur);
+	}
+}
+//===========================================================================
+//===========================================================================
+
+/*
+ *
+ *    UnpredictResiduals()
+ *
+ *    Reconstructs the level in place over the upsampled image. Per row,
+ *    b - c and t = upsampled + error are computed vectorized, then the
+ *    left-neighbour recurrence is resolved with a scalar loop. Codes are
+ *    consumed in raster order of the significant blocks only.
+ *
+ */
+//===========================================================================
+//===========================================================================
+void UnpredictResiduals(const unsigned char* pCodes, KImage* pUpsampled,
+	int intPredictor, const unsigned char* pSignificant, int intBlockSize,
+	int intQuantStep)
+{
+	assert(intPredictor == PREDICT_MED);
+	(void)intPredictor;
+
+	int intWidth = pUpsampled->GetWidth();
+	int intHeight = pUpsampled->GetHeight();
+	BYTE** pData = pUpsampled->GetDataMatrix();
+	if (pSignificant == NULL)
+		intBlockSize = intWidth;
+	int intBlocksPerRow = (intWidth + intBlockSize - 1) / intBlockSize;
+
+	std::vector<short> prev(intWidth + 1, 0);
+	std::vector<short> cur(intWidth + 1, 0);
+	std::vector<short> bc(intWidth);
+	std::vector<short> t(intWidth);
+	for (int y = 0; y < intHeight; y++)
+	{
+		BYTE* pRow = pData[y];
+
+		int x = 0;
+#ifdef PREDICT_SSE2
+		for (; x + 16 <= intWidth; x += 16)
+		{
+			__m128i c0 = _mm_loadu_si128((const __m128i*)(&prev[x]));
+			__m128i b0 = _mm_loadu_si128((const __m128i*)(&prev[x + 1]));
+			__m128i c1 = _mm_loadu_si128((const __m128i*)(&prev[x + 8]));
+			__m128i b1 = _mm_loadu_si128((const __m128i*)(&prev[x + 9]));
+			_mm_storeu_si128((__m128i*)(&bc[x]), _mm_sub_epi16(b0, c0));
+			_mm_storeu_si128((__m128i*)(&bc[x + 8]), _mm_sub_epi16(b1, c1));
+		}
+#endif
+		for (; x < intWidth; x++)
+			bc[x] = short(prev[x + 1] - prev[x]);
+
+		int a = 0;
+		for (int intBlock = 0; intBlock < intBlocksPerRow; intBlock++)
+		{
+			int intStart = intBlock * intBlockSize;
+			int intEnd = std::min(intStart + intBlockSize, intWidth);
+			if (pSignificant != NULL && !pSignificant[(y / intBlockSize) * intBlocksPerRow + intBlock])
+			{
+				std::fill(cur.begin() + intStart + 1, cur.begin() + intEnd + 1, short(0));
+				a = 0;
+				continue;
+			}
+
+			if (intQuantStep > 1)
+			{
+				for (x = intStart; x < intEnd; x++)
+				{
+					int intIndex = (pCodes[x - intStart] - PREDICT_BIAS + MedianPredictor(a, prev[x + 1], bc[x])) & PREDICT_MASK;
+					a = intIndex >= PREDICT_BIAS ? intIndex - (PREDICT_MASK + 1) : intIndex;
+					cur[x + 1] = short(a);
+					pRow[x] = (BYTE)std::max(0, std::min(PREDICT_MASK, pRow[x] + a * intQuantStep));
+				}
+				pCodes += intEnd - intStart;
+				continue;
+			}
+
+			x = intStart;
+#ifdef PREDICT_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i bias = _mm_set1_epi16(PREDICT_BIAS);
+			for (; x + 16 <= intEnd; x += 16)
+			{
+				__m128i up = _mm_loadu_si128((const __m128i*)(pRow + x));
+				__m128i codes = _mm_loadu_si128((const __m128i*)(pCodes + x - intStart));
+				__m128i tLo = _mm_sub_epi16(_mm_add_epi16(_mm_unpacklo_epi8(up, zero),
+					_mm_unpacklo_epi8(codes, zero)), bias);
+				__m128i tHi = _mm_sub_epi16(_mm_add_epi16(_mm_unpackhi_epi8(up, zero),
+					_mm_unpackhi_epi8(codes, zero)), bias);
+				_mm_storeu_si128((__m128i*)(&t[x]), tLo);
+				_mm_storeu_si128((__m128i*)(&t[x + 8]), tHi);
+			}
+#endif
+			for (; x < intEnd; x++)
+				t[x] = short(pRow[x] + pCodes[x - intStart] - PREDICT_BIAS);
+
+			for (x = intStart; x < intEnd; x++)
+			{
+				int intPixel = (t[x] + MedianPredictor(a, prev[x + 1], bc[x])) & PREDICT_MASK;
+				a = intPixel - pRow[x];
+				cur[x + 1] = short(a);
+				pRow[x] = (BYTE)intPixel;
+			}
+			pCodes += intEnd - intStart;
+		}
+		std::swap(prev, cur);
+	}
+}
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,71 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Predict. Spatial prediction of residual planes
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __PREDICT__H__
+#define __PREDICT__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "Direct_Access_Image.h"
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- The residual of a level (original - upsampled) still carries local
+correlation along edges the upsampling filter did not capture. Each residual
+is predicted from its already coded residual neighbours (a = left,
+b = above, c = upper-left) and only the prediction error is stored.
+
+- The prediction error is stored modulo 256. The decoder knows the upsampled
+pixel, and the reconstructed pixel is known to lie in [0, 255], so
+pixel = (upsampled + prediction + error) mod 256 is exact and no escape codes
+are needed for predicted levels.
+
+- Quantized (lossy) levels predict the quantizer indices instead. They lie in
+[-127, 127], so the index is recovered from the error modulo 256 directly and
+the pixel is upsampled + index * step, clamped to [0, 255].
+
+- When a block significance map is given, the codes of all-zero blocks are
+absent from the stream. Their residual is zero by definition, so the decoder
+leaves those pixels untouched and feeds zeros to the neighbouring predictions.
+
+- The MED (LOCO-I) predictor is median(a, b, a + b - c). Its dependency on the
+left neighbour is serial, so the decoder vectorizes the terms that only depend
+on the previous row (b - c, the upsampled row) and runs a branchless scalar
+recurrence for the rest.
+
+*/
+
+//===========================================================================
+//===========================================================================
+#define PREDICT_NONE		0
+#define PREDICT_MED			1
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void PredictResiduals(const short* pResidual, int intWidth, int intHeight,
+	int intPredictor, unsigned char* pCodes);
+void UnpredictResiduals(const unsigned char* pCodes, KImage* pUpsampled,
+	int intPredictor, const unsigned char* pSignificant = NULL, int intBlockSize = 0,
+	int intQuantStep = 1);
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
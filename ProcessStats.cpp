@@ -0,0 +1,81 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  ProcessStats. Resource usage of the running process
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "ProcessStats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <stdio.h>
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+unsigned long long PeakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+#ifdef __linux__
+	// VmHWM follows ResetPeakResident, ru_maxrss does not
+	FILE* pStatus = fopen("/proc/self/status", "r");
+	if (pStatus != NULL)
+	{
+		char strLine[256];
+		unsigned long long intKilobytes = 0;
+		bool boolFound = false;
+		while (!boolFound && fgets(strLine, sizeof(strLine), pStatus) != NULL)
+			boolFound = sscanf(strLine, "VmHWM: %llu kB", &intKilobytes) == 1;
+		fclose(pStatus);
+		if (boolFound)
+			return intKilobytes * 1024;
+	}
+#endif
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (unsigned long long)usage.ru_maxrss;
+#else
+	// Linux counts in kilobytes
+	return (unsigned long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+bool ResetPeakResident()
+{
+#ifdef __linux__
+	FILE* pClear = fopen("/proc/self/clear_refs", "w");
+	if (pClear == NULL)
+		return false;
+	bool boolReset = fputs("5", pClear) >= 0;
+	// The kernel rejects an unknown value on the write, which fclose flushes
+	boolReset = fclose(pClear) == 0 && boolReset;
+	return boolReset;
+#else
+	return false;
+#endif
+}
+//===========================================================================
+//===========================================================================
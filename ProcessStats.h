@@ -0,0 +1,46 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  ProcessStats. Resource usage of the running process
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __PROCESSSTATS__H__
+#define __PROCESSSTATS__H__
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- PeakResidentBytes is the largest resident set (working set on Windows)
+the process has had since it started, or since the last ResetPeakResident,
+as the operating system counts it: PeakWorkingSetSize from
+GetProcessMemoryInfo, VmHWM from /proc/self/status on Linux, ru_maxrss from
+getrusage elsewhere. Otherwise it never goes down, so after a sequence of
+jobs it is the peak of the largest one so far.
+
+- Returns 0 where the figure is not available.
+
+- ResetPeakResident lowers the peak to the current resident set, so that the
+next reading is the peak of what ran in between. Only Linux can do that
+(writing "5" to /proc/self/clear_refs, since kernel 4.0); elsewhere, and
+when the kernel refuses, it returns false and the peak stays process-wide.
+
+*/
+
+//===========================================================================
+//===========================================================================
+unsigned long long PeakResidentBytes();
+bool ResetPeakResident();
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,1555 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Pyramid. Residual pyramid codec and .pyr container
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "Pyramid.h"
+#include "Resample.h"
+#include "Wavelet.h"
+#include "Residual.h"
+#include "BitVector.h"
+#include "Checksum.h"
+
+#include <iostream>
+#include <climits>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <mutex>
+#include <thread>
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#define MAX_CHAR		128
+#define MASK_1			0x01
+#define M_BZ_SMALL		0
+#define M_BZ_VERB		0
+#define M_BZ_BLK_SIZE	9
+#define M_BZ_WORK_FACT	0
+#define COEF_ESCAPE		255
+#define CONTAINER_VERSION	2
+#define CONTAINER_PREFIX	16
+#define CONTAINER_ENTRY		32
+#define SECTION_OPTIONS		0
+#define SECTION_TOP			1
+#define SECTION_SEGMENT		2
+#define FLAG_CHECKSUMS		1
+#define MAX_BIT_PLANES		15
+#define SEGMENT_CHUNK		(1 << 20)
+//===========================================================================
+//===========================================================================
+
+template <typename U, typename T>
+void Write(U* buf, T val) {
+	*reinterpret_cast<T*>(buf) = val;
+}
+
+template <typename T, typename U>
+T Read(U* buf) {
+	return *reinterpret_cast<const T*>(buf);
+}
+
+// Explicit little-endian fields for the container, independent of the host
+template <typename T>
+void PutLE(std::vector<unsigned char>& out, T val) {
+	for (unsigned int i = 0; i < sizeof(T); i++) {
+		out.push_back((unsigned char)((unsigned long long)val >> (SIZE_UCHAR * i)));
+	}
+}
+
+template <typename T>
+T GetLE(const unsigned char* buf) {
+	unsigned long long val = 0;
+	for (unsigned int i = 0; i < sizeof(T); i++) {
+		val |= (unsigned long long)buf[i] << (SIZE_UCHAR * i);
+	}
+	return (T)val;
+}
+
+template <typename T>
+void TestPrint(T* vec, unsigned int num) {
+	for (unsigned int i = 0; i < num; i++) {
+		std::cout << std::forward<T>(vec[i]) << "\n";
+	}
+}
+
+/*
+ * Segments keep 32-bit sizes, as bzip2's buffer interface does. An image whose
+ * residual data does not fit cannot be encoded; the container's 64-bit fields
+ * leave room for splitting such data over several segments later.
+ *
+ * The data is handed to bzip2 SEGMENT_CHUNK bytes at a time, polling cancel in
+ * between; a cancelled segment comes back without data.
+ */
+Segment CompressSegment(const std::vector<unsigned char>& data, const std::atomic<bool>* cancel) {
+	if (data.size() > (UINT_MAX - 600) / 101 * 100) {
+		throw std::length_error("segment data above the 32-bit segment size");
+	}
+	Segment segment;
+	segment.uncompressedSize = data.size();
+	// bzip2 output may exceed its input by 1% + 600 bytes on incompressible data
+	unsigned int capacity = data.size() + data.size() / 100 + 600;
+	bz_stream stream;
+	std::memset(&stream, 0, sizeof(stream));
+	if (BZ2_bzCompressInit(&stream, M_BZ_BLK_SIZE, M_BZ_VERB, M_BZ_WORK_FACT) != BZ_OK) {
+		throw std::bad_alloc();
+	}
+	segment.data = new unsigned char[capacity];
+	stream.next_out = (char*)segment.data;
+	stream.avail_out = capacity;
+	int result = BZ_RUN_OK;
+	for (size_t consumed = 0; consumed < data.size() && result == BZ_RUN_OK && !Cancelled(cancel); ) {
+		unsigned int count = (unsigned int)std::min<size_t>(data.size() - consumed, SEGMENT_CHUNK);
+		stream.next_in = (char*)&data[consumed];
+		stream.avail_in = count;
+		result = BZ2_bzCompress(&stream, BZ_RUN);
+		consumed += count - stream.avail_in;
+	}
+	if (result == BZ_RUN_OK && !Cancelled(cancel)) {
+		result = BZ2_bzCompress(&stream, BZ_FINISH);
+	}
+	segment.compressedSize = capacity - stream.avail_out;
+	BZ2_bzCompressEnd(&stream);
+	if (Cancelled(cancel)) {
+		delete[] segment.data;
+		segment.data = nullptr;
+		segment.compressedSize = 0;
+		segment.checksum = 0;
+		return segment;
+	}
+	// With the output sized as above, running out of memory is the only failure
+	if (result != BZ_STREAM_END) {
+		delete[] segment.data;
+		throw std::bad_alloc();
+	}
+	segment.checksum = Crc32c(segment.data, segment.compressedSize);
+	return segment;
+}
+
+/*
+ * False when bzip2 rejects the stream or it does not inflate to exactly the
+ * stored size, and when cancelled. The output grows with what the stream
+ * yields rather than being sized from the header, so a damaged size cannot
+ * force a huge allocation; bzip2 fills at most SEGMENT_CHUNK bytes of it
+ * between polls of cancel.
+ */
+bool DecompressSegment(const Segment& segment, std::vector<unsigned char>& data, const std::atomic<bool>* cancel) {
+	// Files from before CompressSegment handled empty data hold a few
+	// arbitrary bytes for an empty segment
+	if (segment.uncompressedSize == 0) {
+		data.clear();
+		return true;
+	}
+	bz_stream stream;
+	std::memset(&stream, 0, sizeof(stream));
+	if (BZ2_bzDecompressInit(&stream, M_BZ_VERB, M_BZ_SMALL) != BZ_OK) {
+		return false;
+	}
+	stream.next_in = (char*)segment.data;
+	stream.avail_in = segment.compressedSize;
+	data.resize(std::min<unsigned int>(segment.uncompressedSize, SEGMENT_CHUNK));
+	unsigned int produced = 0;
+	int result = BZ_OK;
+	while (result == BZ_OK && !Cancelled(cancel)) {
+		if (produced == data.size()) {
+			if (produced == segment.uncompressedSize) {
+				break;
+			}
+			data.resize(std::min<size_t>(segment.uncompressedSize, 2 * data.size()));
+		}
+		unsigned int room = std::min<unsigned int>((unsigned int)data.size() - produced, SEGMENT_CHUNK);
+		stream.next_out = (char*)&data[produced];
+		stream.avail_out = room;
+		result = BZ2_bzDecompress(&stream);
+		produced += room - stream.avail_out;
+		// All input is there from the start: room left over means it ran out
+		if (result == BZ_OK && stream.avail_out != 0) {
+			break;
+		}
+	}
+	BZ2_bzDecompressEnd(&stream);
+	return result == BZ_STREAM_END && produced == segment.uncompressedSize;
+}
+
+BitVector BlockSignificance(const std::vector<short>& residual, int width, int height, int blockSize) {
+	BitVector map;
+	for (int by = 0; by < height; by += blockSize) {
+		for (int bx = 0; bx < width; bx += blockSize) {
+			unsigned char significant = 0;
+			for (int i = by; i < std::min(by + blockSize, height) && !significant; i++) {
+				for (int j = bx; j < std::min(bx + blockSize, width); j++) {
+					if (residual[i * width + j] != 0) {
+						significant = 1;
+						break;
+					}
+				}
+			}
+			map.Add(significant);
+		}
+	}
+	return map;
+}
+
+unsigned int SignificantPixels(std::vector<unsigned char>& flags, int width, int height, int blockSize) {
+	unsigned int count = 0;
+	int blocksPerRow = (width + blockSize - 1) / blockSize;
+	for (unsigned int b = 0; b < flags.size(); b++) {
+		if (flags[b]) {
+			count += std::min(blockSize, width - int(b % blocksPerRow) * blockSize) *
+				std::min(blockSize, height - int(b / blocksPerRow) * blockSize);
+		}
+	}
+	return count;
+}
+
+struct LevelStream {
+	std::vector<unsigned char> map;
+	std::vector<short> values;
+	std::vector<unsigned char> codes;
+	std::vector<unsigned int> escapes;
+	std::vector<short> escapeValues;
+	double entropy;
+	LevelStream() : entropy(0) {}
+};
+
+unsigned char QuantStep(const CodecOptions& options, unsigned int level) {
+	if (options.quantSteps.empty()) {
+		return 1;
+	}
+	unsigned char step = options.quantSteps[std::min<size_t>(level, options.quantSteps.size() - 1)];
+	return std::max<unsigned char>(step, 1);
+}
+
+// A zero quantizer step marks a level whose residual is entirely zero
+bool LevelSkipped(const CodecOptions& options, unsigned int level) {
+	return level < options.quantSteps.size() && options.quantSteps[level] == 0;
+}
+
+unsigned char LevelFilter(const CodecOptions& options, unsigned int level) {
+	if (options.filters.empty()) {
+		return FILTER_LANCZOS3;
+	}
+	return options.filters[std::min<unsigned int>(level, options.filters.size() - 1)];
+}
+
+short Quantize(short diff, unsigned char step) {
+	short q = (std::abs(diff) + step / 2) / step;
+	q = std::min(q, short(MAX_CHAR - 1));
+	return diff < 0 ? -q : q;
+}
+
+/*
+ * The pool is sized to the hardware threads, created on first use (call_once
+ * rather than a function static, which VS2013 does not make thread safe)
+ * and never destroyed, so that no job is cut short at exit.
+ */
+std::once_flag codecPoolOnce;
+ThreadPool* codecPool = nullptr;
+
+ThreadPool& CodecPool() {
+	std::call_once(codecPoolOnce, []() {
+		codecPool = new ThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+	});
+	return *codecPool;
+}
+
+/*
+ * Cooperative cancellation: long loops poll the caller's flag between levels,
+ * between row bands and every SEGMENT_CHUNK bytes bzip2 compresses or
+ * inflates, and give up with nullptr. A null flag is never cancelled.
+ */
+bool Cancelled(const std::atomic<bool>* cancel) {
+	return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+}
+
+// The KImage copy constructor clones the FIBITMAP, which does not see pixels
+// written through the data matrix
+KImage* CopyImage(KImage* image) {
+	KImage* copy = new KImage(image->GetWidth(), image->GetHeight(), SIZE_UCHAR);
+	for (int i = 0; i < image->GetHeight(); i++) {
+		std::memcpy(copy->GetDataMatrix()[i], image->GetDataMatrix()[i], image->GetWidth());
+	}
+	return copy;
+}
+
+/*
+ * CRC32C of the pixels, row by row, without the row padding.
+ */
+unsigned int ImageChecksum(KImage* image) {
+	unsigned int checksum = 0;
+	auto imgData = image->GetDataMatrix();
+	for (int i = 0; i < image->GetHeight(); i++) {
+		checksum = Crc32c(imgData[i], image->GetWidth(), checksum);
+	}
+	return checksum;
+}
+
+unsigned char ClampPixel(int value) {
+	return (unsigned char)std::max(0, std::min(MAX_UCHAR, value));
+}
+
+double ResidualBits(KImage* image, KImage* upsampledImage) {
+	auto data1 = image->GetDataMatrix();
+	auto data2 = upsampledImage->GetDataMatrix();
+	std::vector<unsigned int> histogram(2 * MAX_UCHAR + 1, 0);
+	for (int i = 0; i < image->GetHeight(); i++) {
+		for (int j = 0; j < image->GetWidth(); j++) {
+			histogram[data1[i][j] - data2[i][j] + MAX_UCHAR]++;
+		}
+	}
+	double count = double(image->GetWidth()) * image->GetHeight();
+	double bits = 0;
+	for (auto c : histogram) {
+		if (c != 0) {
+			bits -= c * std::log2(c / count);
+		}
+	}
+	return bits;
+}
+
+bool EncodeLevel(KImage* image, KImage* upsampledImage, const CodecOptions& options, 
+	unsigned char step, LevelStream& out) {
+	auto data1 = image->GetDataMatrix();
+	auto data2 = upsampledImage->GetDataMatrix();
+	int width = image->GetWidth();
+	int height = image->GetHeight();
+
+	std::vector<short> residual(width * height);
+	for (int i = 0; i < height; i++) {
+		ComputeResiduals(data1[i], data2[i], width, &residual[i * width]);
+	}
+
+	// Zero-order entropy of the residual before quantization, for reports
+	std::vector<unsigned int> histogram(2 * MAX_UCHAR + 1, 0);
+	for (auto r : residual) {
+		histogram[r + MAX_UCHAR]++;
+	}
+	double count = double(residual.size());
+	for (auto c : histogram) {
+		if (c != 0) {
+			out.entropy -= c / count * std::log2(c / count);
+		}
+	}
+
+	// Leave the reconstruction the decoder will see in upsampledImage
+	if (step > 1) {
+		for (int i = 0; i < height; i++) {
+			short* row = &residual[i * width];
+			for (int j = 0; j < width; j++) {
+				row[j] = Quantize(row[j], step);
+			}
+			ApplyResiduals(data2[i], row, width, step);
+		}
+	}
+	else {
+		for (int i = 0; i < height; i++) {
+			std::memcpy(data2[i], data1[i], width);
+		}
+	}
+
+	if (std::all_of(residual.begin(), residual.end(), [](short r) { return r == 0; })) {
+		return false;
+	}
+
+	std::vector<unsigned char> codes;
+	if (options.predictor != PREDICT_NONE && options.bitPlanes == 0) {
+		codes.resize(residual.size());
+		PredictResiduals(&residual[0], width, height, options.predictor, &codes[0]);
+	}
+
+	int blockSize = options.blockSize != 0 ? options.blockSize : width;
+	int blocksPerRow = (width + blockSize - 1) / blockSize;
+	BitVector significance;
+	if (options.blockSize != 0) {
+		significance = BlockSignificance(residual, width, height, blockSize);
+		out.map = significance.GetBytes();
+	}
+
+	// Coded pixels are sized up front, the kernels write spans in place
+	unsigned int numCoded = 0;
+	for (int i = 0; i < height; i++) {
+		for (int b = 0; b < blocksPerRow; b++) {
+			if (options.blockSize == 0 || significance[(i / blockSize) * blocksPerRow + b] != 0) {
+				numCoded += std::min((b + 1) * blockSize, width) - b * blockSize;
+			}
+		}
+	}
+	if (options.bitPlanes != 0) {
+		out.values.resize(numCoded);
+	}
+	else {
+		out.codes.resize(numCoded);
+	}
+
+	unsigned int k = 0;
+	for (int i = 0; i < height; i++) {
+		for (int b = 0; b < blocksPerRow; b++) {
+			if (options.blockSize != 0 && significance[(i / blockSize) * blocksPerRow + b] == 0) {
+				continue;
+			}
+			int start = b * blockSize;
+			int count = std::min((b + 1) * blockSize, width) - start;
+			const short* span = &residual[i * width + start];
+			if (options.bitPlanes != 0) {
+				std::copy(span, span + count, out.values.begin() + k);
+			}
+			else if (options.predictor != PREDICT_NONE) {
+				std::copy(codes.begin() + i * width + start, codes.begin() + i * width + start + count, out.codes.begin() + k);
+			}
+			else if (BiasResiduals(span, count, &out.codes[k]) != 0) {
+				for (int j = 0; j < count; j++) {
+					short diff = span[j];
+					if (diff + MAX_CHAR > MAX_UCHAR || diff + MAX_CHAR < 0) {
+						out.escapes.push_back(k + j);
+						out.codes[k + j] = std::abs(diff);
+						out.escapeValues.push_back(diff);
+					}
+				}
+			}
+			k += count;
+		}
+	}
+	return true;
+}
+
+// False when the maps run past the end of data, or when a coded level has
+// no significant block: the encoder skips all-zero levels instead
+bool ReadSignificanceMaps(const std::vector<unsigned char>& data, unsigned int& offset, 
+	const std::vector<std::pair<unsigned int, unsigned int>>& dimVec, const CodecOptions& options,
+	std::vector<std::vector<unsigned char>>& levelFlags, std::vector<unsigned int>& levelSizes) {
+	levelFlags.resize(dimVec.size());
+	levelSizes.resize(dimVec.size());
+	for (unsigned int li = 0; li < dimVec.size(); li++) {
+		auto dim = dimVec[li];
+		if (LevelSkipped(options, li)) {
+			levelSizes[li] = 0;
+			continue;
+		}
+		if (options.blockSize == 0) {
+			levelSizes[li] = dim.first * dim.second;
+			continue;
+		}
+		unsigned int numBlocks = ((dim.first + options.blockSize - 1) / options.blockSize) *
+			((dim.second + options.blockSize - 1) / options.blockSize);
+		unsigned int numBytes = std::ceil(numBlocks / float(SIZE_UCHAR));
+		if (numBytes > data.size() - offset) {
+			return false;
+		}
+		BitVector map(data.data() + offset, numBlocks);
+		offset += numBytes;
+		levelFlags[li].resize(numBlocks);
+		for (unsigned int b = 0; b < numBlocks; b++) {
+			levelFlags[li][b] = map[b];
+		}
+		levelSizes[li] = SignificantPixels(levelFlags[li], dim.first, dim.second, options.blockSize);
+		if (levelSizes[li] == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::vector<Segment> EncodeBitPlanes(const std::vector<LevelStream>& streams, CodecOptions& options, 
+	const std::atomic<bool>* cancel) {
+	short maxMagnitude = 0;
+	unsigned int numValues = 0;
+	for (auto& stream : streams) {
+		numValues += stream.values.size();
+		for (auto v : stream.values) {
+			maxMagnitude = std::max<short>(maxMagnitude, std::abs(v));
+		}
+	}
+	options.bitPlanes = 1;
+	while ((maxMagnitude >> options.bitPlanes) != 0) {
+		options.bitPlanes++;
+	}
+
+	// One layer per magnitude bit plane, most significant first. A sign bit
+	// follows the first set bit of each value.
+	std::vector<Segment> segments;
+	for (int plane = options.bitPlanes - 1; plane >= 0 && !Cancelled(cancel); plane--) {
+		std::vector<unsigned char> layer;
+		if (plane == options.bitPlanes - 1) {
+			for (auto& stream : streams) {
+				layer.insert(layer.end(), stream.map.begin(), stream.map.end());
+			}
+		}
+		BitVector bits;
+		bits.Reserve(numValues);
+		for (auto& stream : streams) {
+			for (auto v : stream.values) {
+				short magnitude = std::abs(v);
+				unsigned char bit = (magnitude >> plane) & MASK_1;
+				bits.Add(bit);
+				if (bit != 0 && (magnitude >> (plane + 1)) == 0) {
+					bits.Add(v < 0 ? 1 : 0);
+				}
+			}
+		}
+		size_t mapBytes = layer.size();
+		layer.resize(mapBytes + bits.GetByteSize());
+		if (bits.GetByteSize() != 0) {
+			bits.CopyBytes(&layer[mapBytes]);
+		}
+		segments.push_back(CompressSegment(layer, cancel));
+	}
+	return segments;
+}
+
+/*
+ * Wavelet coefficients are zigzag mapped to unsigned; values below
+ * COEF_ESCAPE take one byte, the rare larger ones an escape plus two bytes.
+ */
+void PutCoefficient(std::vector<unsigned char>& data, int value) {
+	unsigned int zigzag = value < 0 ? -2 * value - 1 : 2 * value;
+	if (zigzag < COEF_ESCAPE) {
+		data.push_back(zigzag);
+		return;
+	}
+	data.push_back(COEF_ESCAPE);
+	data.push_back(zigzag & MAX_UCHAR);
+	data.push_back(zigzag >> SIZE_UCHAR);
+}
+
+// False at the end of data
+bool GetCoefficient(const std::vector<unsigned char>& data, unsigned int& offset, int& value) {
+	if (offset >= data.size()) {
+		return false;
+	}
+	unsigned int zigzag = data[offset++];
+	if (zigzag == COEF_ESCAPE) {
+		if (data.size() - offset < 2) {
+			return false;
+		}
+		zigzag = data[offset] | (data[offset + 1] << SIZE_UCHAR);
+		offset += 2;
+	}
+	value = (zigzag & MASK_1) != 0 ? -int((zigzag + 1) / 2) : int(zigzag / 2);
+	return true;
+}
+
+// Uniform rounding quantizer for detail coefficients; unlike Quantize there is
+// no clamp, as PutCoefficient takes any 16-bit value
+int QuantizeCoefficient(int value, int step) {
+	int q = (std::abs(value) + step / 2) / step;
+	return value < 0 ? -q : q;
+}
+
+/*
+ * 5/3 wavelet backend. The detail bands are stored finest level first, each
+ * divided by its level's quantizer step (lossless with step 1); the top image
+ * holds the final LL band clamped to bytes, followed in the stream by the
+ * (almost always zero) difference to the exact LL values. The LL band is never
+ * quantized.
+ */
+Pyramid* CompressWavelet(KImage* image, const CodecOptions& options, long double* psnr = nullptr, 
+		const std::atomic<bool>* cancel = nullptr) {
+	int width = image->GetWidth();
+	int height = image->GetHeight();
+	auto imgData = image->GetDataMatrix();
+	std::vector<int> plane(width * height);
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			plane[i * width + j] = imgData[i][j];
+		}
+	}
+
+	WaveletPyramid shape;
+	std::vector<std::pair<unsigned int, unsigned int>> dimVec;
+	auto dims = std::make_pair((unsigned int)width, (unsigned int)height);
+	while (true) {
+		auto next = std::make_pair(shape.Downsample(dims.first), shape.Downsample(dims.second));
+		if (next.first <= MIN_IMG_WIDTH || next.second <= MIN_IMG_HEIGHT) {
+			break;
+		}
+		if (Cancelled(cancel)) {
+			return nullptr;
+		}
+		ForwardWavelet53(&plane[0], dims.first, dims.second, width);
+		dimVec.push_back(dims);
+		dims = next;
+	}
+	unsigned char numLevels = (unsigned char)dimVec.size();
+
+	CodecOptions levelOptions;
+	levelOptions.transform = TRANSFORM_WAVELET53;
+	levelOptions.blockSize = 0;
+	levelOptions.quantSteps.resize(numLevels);
+	levelOptions.ratio = MIN_RATIO;
+	levelOptions.filters.assign(numLevels, FILTER_LANCZOS3);
+	bool lossless = true;
+	for (unsigned int li = 0; li < numLevels; li++) {
+		levelOptions.quantSteps[li] = QuantStep(options, li);
+		lossless = lossless && levelOptions.quantSteps[li] == 1;
+	}
+
+	// The plane keeps the dequantized coefficients, i.e. what the decoder sees
+	std::vector<unsigned char> data;
+	for (unsigned int li = 0; li < numLevels; li++) {
+		auto low = li + 1 < numLevels ? dimVec[li + 1] : dims;
+		int step = levelOptions.quantSteps[li];
+		for (unsigned int i = 0; i < dimVec[li].second; i++) {
+			for (unsigned int j = 0; j < dimVec[li].first; j++) {
+				if (i < low.second && j < low.first) {
+					continue;
+				}
+				int q = QuantizeCoefficient(plane[i * width + j], step);
+				PutCoefficient(data, q);
+				plane[i * width + j] = q * step;
+			}
+		}
+	}
+
+	KImage* topImage = new KImage(dims.first, dims.second, SIZE_UCHAR);
+	for (unsigned int i = 0; i < dims.second; i++) {
+		for (unsigned int j = 0; j < dims.first; j++) {
+			int value = plane[i * width + j];
+			topImage->GetDataMatrix()[i][j] = ClampPixel(value);
+			PutCoefficient(data, value - topImage->GetDataMatrix()[i][j]);
+		}
+	}
+
+	// A lossy encode runs the decoder's inverse transform for the checksum
+	// and PSNR of what a full decode returns
+	std::unique_ptr<KImage> reconstructed;
+	if (!lossless) {
+		for (int li = int(numLevels) - 1; li >= 0; li--) {
+			InverseWavelet53(&plane[0], dimVec[li].first, dimVec[li].second, width);
+		}
+		reconstructed.reset(new KImage(width, height, SIZE_UCHAR));
+		for (int i = 0; i < height; i++) {
+			for (int j = 0; j < width; j++) {
+				reconstructed->GetDataMatrix()[i][j] = ClampPixel(plane[i * width + j]);
+			}
+		}
+	}
+	KImage* decoded = lossless ? image : reconstructed.get();
+	if (psnr != nullptr) {
+		*psnr = PSNR(MSE(image, decoded));
+	}
+
+	std::vector<Segment> segments(1, CompressSegment(data, cancel));
+	WaveletPyramid* p = new WaveletPyramid(segments, numLevels, std::make_pair((unsigned int)width, (unsigned int)height), 
+		topImage, levelOptions);
+	if (Cancelled(cancel)) {
+		delete p;
+		return nullptr;
+	}
+	p->SetImageChecksum(ImageChecksum(decoded));
+	return p;
+}
+
+/*
+ * Decodes down to level: the inverse transform stops there, and the low band
+ * it leaves in the corner of the plane is that level's image. The 5/3 low
+ * pass keeps the mean, so the band only needs clamping to bytes.
+ */
+KImage* DecompressWavelet(Pyramid* p, unsigned int level = 0, const std::atomic<bool>* cancel = nullptr) {
+	std::vector<unsigned char> data;
+	if (!DecompressSegment(p->GetSegment(0), data, cancel)) {
+		return nullptr;
+	}
+	unsigned int offset = 0;
+	auto dims = p->GetDims();
+	int width = dims.first;
+	std::vector<int> plane((size_t)dims.first * dims.second);
+
+	std::vector<std::pair<unsigned int, unsigned int>> dimVec;
+	for (unsigned int i = 0; i < p->GetNumLevels(); i++) {
+		dimVec.push_back(dims);
+		dims = std::make_pair(p->Downsample(dims.first), p->Downsample(dims.second));
+	}
+
+	for (unsigned int li = 0; li < dimVec.size(); li++) {
+		auto low = li + 1 < dimVec.size() ? dimVec[li + 1] : dims;
+		int step = QuantStep(p->GetOptions(), li);
+		for (unsigned int i = 0; i < dimVec[li].second; i++) {
+			for (unsigned int j = 0; j < dimVec[li].first; j++) {
+				if (i < low.second && j < low.first) {
+					continue;
+				}
+				int value;
+				if (!GetCoefficient(data, offset, value)) {
+					return nullptr;
+				}
+				plane[i * width + j] = value * step;
+			}
+		}
+	}
+
+	auto topData = p->GetTopImage()->GetDataMatrix();
+	for (unsigned int i = 0; i < dims.second; i++) {
+		for (unsigned int j = 0; j < dims.first; j++) {
+			int value;
+			if (!GetCoefficient(data, offset, value)) {
+				return nullptr;
+			}
+			plane[i * width + j] = topData[i][j] + value;
+		}
+	}
+	if (offset != data.size()) {
+		return nullptr;
+	}
+
+	for (int li = int(dimVec.size()) - 1; li >= int(level); li--) {
+		if (Cancelled(cancel)) {
+			return nullptr;
+		}
+		InverseWavelet53(&plane[0], dimVec[li].first, dimVec[li].second, width);
+	}
+
+	auto out = level < dimVec.size() ? dimVec[level] : dims;
+	KImage* pImage = new KImage(out.first, out.second, SIZE_UCHAR);
+	for (unsigned int i = 0; i < out.second; i++) {
+		for (unsigned int j = 0; j < out.first; j++) {
+			pImage->GetDataMatrix()[i][j] = ClampPixel(plane[i * width + j]);
+		}
+	}
+	return pImage;
+}
+
+/*
+ * Adaptive level count: one more level pays off while its estimated residual
+ * size plus the smaller top image and the per-level header is below the cost
+ * of storing the current image raw as the top.
+ */
+bool LevelPays(KImage* image, KImage* downsampledImage, const CodecOptions& options, unsigned int level) {
+	KImage upsampledImage(image->GetWidth(), image->GetHeight(), SIZE_UCHAR);
+	Resample(downsampledImage, &upsampledImage, LevelFilter(options, level));
+	double levelBits = ResidualBits(image, &upsampledImage) + 
+		double(downsampledImage->GetWidth()) * downsampledImage->GetHeight() * SIZE_UCHAR + 2 * SIZE_UCHAR;
+	if (options.blockSize != 0) {
+		levelBits += ((image->GetWidth() + options.blockSize - 1) / options.blockSize) *
+			((image->GetHeight() + options.blockSize - 1) / options.blockSize);
+	}
+	return levelBits < double(image->GetWidth()) * image->GetHeight() * SIZE_UCHAR;
+}
+
+Pyramid* Compress(KImage* image, const CodecOptions& options, long double* psnr, 
+		const std::atomic<bool>* cancel) {
+	if (options.transform == TRANSFORM_WAVELET53) {
+		return CompressWavelet(image, options, psnr, cancel);
+	}
+	std::pair<unsigned int, unsigned int> dims;
+	dims = std::make_pair(image->GetWidth(), image->GetHeight());
+
+	unsigned char ratio = std::max<unsigned char>(options.ratio, MIN_RATIO);
+	std::vector<KImage*> levels(1, image);
+	while (true) {
+		int newWidth = int(ScaleDown(levels.back()->GetWidth(), ratio));
+		int newHeight = int(ScaleDown(levels.back()->GetHeight(), ratio));
+		if (newWidth <= MIN_IMG_WIDTH || newHeight <= MIN_IMG_HEIGHT || Cancelled(cancel)) {
+			break;
+		}
+		KImage* downsampledImage = new KImage(newWidth, newHeight, SIZE_UCHAR);
+		Resample(levels.back(), downsampledImage, LevelFilter(options, levels.size() - 1));
+		if (options.adaptiveLevels && !LevelPays(levels.back(), downsampledImage, options, levels.size() - 1)) {
+			delete downsampledImage;
+			break;
+		}
+		levels.push_back(downsampledImage);
+	}
+	unsigned char numLevels = (unsigned char)(levels.size() - 1);
+
+	CodecOptions levelOptions = options;
+	levelOptions.ratio = ratio;
+	levelOptions.quantSteps.resize(numLevels);
+	levelOptions.filters.resize(numLevels);
+	for (unsigned int level = 0; level < numLevels; level++) {
+		levelOptions.quantSteps[level] = QuantStep(options, level);
+		levelOptions.filters[level] = LevelFilter(options, level);
+	}
+
+	// Closed loop: every level is predicted from the reconstruction of the
+	// coarser one, exactly as the decoder will see it. That reconstruction is
+	// the original level whenever the coarser level is lossless, so the levels
+	// split into chains that only depend on already built images and are
+	// encoded concurrently.
+	std::vector<std::pair<int, int>> chains;
+	for (int level = int(numLevels) - 1; level >= 0; level--) {
+		if (level == int(numLevels) - 1 || levelOptions.quantSteps[level + 1] == 1) {
+			chains.push_back(std::make_pair(level, level));
+		}
+		chains.back().second = level;
+	}
+	std::sort(chains.begin(), chains.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+		return a.second < b.second;
+	});
+
+	std::vector<LevelStream> streams(numLevels);
+	std::vector<unsigned char> zeroLevels(numLevels, 0);
+	KImage* reconstructed = levels.back();
+	CodecPool().ParallelFor(chains.size(), [&](size_t c) {
+		KImage* source = levels[chains[c].first + 1];
+		for (int level = chains[c].first; level >= chains[c].second && !Cancelled(cancel); level--) {
+			KImage* upsampledImage = new KImage(levels[level]->GetWidth(), levels[level]->GetHeight(), SIZE_UCHAR);
+			Resample(source, upsampledImage, levelOptions.filters[level]);
+			if (!EncodeLevel(levels[level], upsampledImage, levelOptions, levelOptions.quantSteps[level], streams[level])) {
+				zeroLevels[level] = 1;
+			}
+			if (source != levels[chains[c].first + 1]) {
+				delete source;
+			}
+			source = upsampledImage;
+		}
+		if (source == levels[chains[c].first + 1]) {
+			// Cancelled before the chain's first level
+		}
+		else if (chains[c].second == 0) {
+			reconstructed = source;
+		}
+		else {
+			delete source;
+		}
+	});
+
+	for (unsigned int level = 0; level < numLevels; level++) {
+		if (zeroLevels[level] != 0) {
+			levelOptions.quantSteps[level] = 0;
+		}
+		if (level != 0) {
+			delete levels[level];
+		}
+	}
+	if (Cancelled(cancel)) {
+		if (reconstructed != levels.back()) {
+			delete reconstructed;
+		}
+		if (levels.back() != image) {
+			delete levels.back();
+		}
+		return nullptr;
+	}
+	if (psnr != nullptr) {
+		*psnr = PSNR(MSE(image, reconstructed));
+	}
+	// The closed loop reconstruction is exactly what a full decode returns
+	unsigned int checksum = ImageChecksum(reconstructed);
+	std::vector<double> entropies;
+	for (auto& stream : streams) {
+		entropies.push_back(stream.entropy);
+	}
+	if (reconstructed != levels.back()) {
+		delete reconstructed;
+	}
+
+	KImage* topImage = levels.back();
+	if (topImage == image) {
+		topImage = CopyImage(image);
+	}
+	if (options.bitPlanes != 0) {
+		std::vector<Segment> layers = EncodeBitPlanes(streams, levelOptions, cancel);
+		ResidualPyramid* p = new ResidualPyramid(layers, numLevels, dims, topImage, levelOptions);
+		if (Cancelled(cancel)) {
+			delete p;
+			return nullptr;
+		}
+		p->SetImageChecksum(checksum);
+		p->SetLevelEntropies(entropies);
+		return p;
+	}
+
+	// Every section is sized before anything is written
+	unsigned int numEscapes = 0;
+	unsigned int mapsSize = 0;
+	unsigned int codesSize = 0;
+	for (auto& stream : streams) {
+		numEscapes += stream.escapes.size();
+		mapsSize += stream.map.size();
+		codesSize += stream.codes.size();
+	}
+	unsigned int signsSize = (numEscapes + SIZE_UCHAR - 1) / SIZE_UCHAR;
+	std::vector<unsigned char> data(sizeof(unsigned int) + numEscapes * sizeof(unsigned int) + 
+		signsSize + mapsSize + codesSize, 0);
+
+	Write(&data[0], numEscapes);
+	unsigned int positionOffset = sizeof(unsigned int);
+	unsigned int signOffset = positionOffset + numEscapes * sizeof(unsigned int);
+	unsigned int mapOffset = signOffset + signsSize;
+	unsigned int codeOffset = mapOffset + mapsSize;
+	unsigned int escape = 0;
+	unsigned int codesWritten = 0;
+	BitVector signs;
+	signs.Reserve(numEscapes);
+	for (auto& stream : streams) {
+		for (unsigned int i = 0; i < stream.escapes.size(); i++, escape++) {
+			Write(&data[positionOffset + escape * sizeof(unsigned int)], codesWritten + stream.escapes[i]);
+		}
+		if (!stream.escapeValues.empty()) {
+			signs.AppendSigns(&stream.escapeValues[0], stream.escapeValues.size());
+		}
+		if (!stream.map.empty()) {
+			std::memcpy(&data[mapOffset], &stream.map[0], stream.map.size());
+			mapOffset += stream.map.size();
+		}
+		if (!stream.codes.empty()) {
+			std::memcpy(&data[codeOffset + codesWritten], &stream.codes[0], stream.codes.size());
+			codesWritten += stream.codes.size();
+		}
+	}
+	if (numEscapes != 0) {
+		signs.CopyBytes(&data[signOffset]);
+	}
+
+	std::vector<Segment> segments(1, CompressSegment(data, cancel));
+	ResidualPyramid* p = new ResidualPyramid(segments, numLevels, dims, topImage, levelOptions);
+	if (Cancelled(cancel)) {
+		delete p;
+		return nullptr;
+	}
+	p->SetImageChecksum(checksum);
+	p->SetLevelEntropies(entropies);
+	return p;
+}
+
+
+Container BuildContainer(Pyramid* p, unsigned int alignment) {
+	Container c;
+	auto& options = p->GetOptions();
+	KImage* topImage = p->GetTopImage();
+	unsigned char numLevels = p->GetNumLevels();
+	PutLE<unsigned long long>(c.options, p->GetDims().first);
+	PutLE<unsigned long long>(c.options, p->GetDims().second);
+	PutLE<unsigned char>(c.options, numLevels);
+	PutLE<unsigned char>(c.options, options.predictor);
+	PutLE<unsigned char>(c.options, options.blockSize);
+	PutLE<unsigned char>(c.options, options.bitPlanes);
+	PutLE<unsigned char>(c.options, options.transform);
+	PutLE<unsigned char>(c.options, options.ratio);
+	c.options.insert(c.options.end(), options.quantSteps.begin(), options.quantSteps.begin() + numLevels);
+	c.options.insert(c.options.end(), options.filters.begin(), options.filters.begin() + numLevels);
+	PutLE<unsigned long long>(c.options, topImage->GetWidth());
+	PutLE<unsigned long long>(c.options, topImage->GetHeight());
+
+	auto topData = topImage->GetDataMatrix();
+	c.topWidth = topImage->GetWidth();
+	unsigned int topChecksum = 0;
+	for (int i = 0; i < topImage->GetHeight(); i++) {
+		c.topRows.push_back(topData[i]);
+		topChecksum = Crc32c(topData[i], c.topWidth, topChecksum);
+	}
+	unsigned long long topSize = (unsigned long long)c.topWidth * c.topRows.size();
+
+	unsigned int numSections = 2 + p->GetNumSegments();
+	c.header.insert(c.header.end(), "PYV", "PYV" + 3);
+	PutLE<unsigned char>(c.header, CONTAINER_VERSION);
+	PutLE<unsigned int>(c.header, p->HasChecksums() ? FLAG_CHECKSUMS : 0);
+	PutLE<unsigned int>(c.header, p->GetImageChecksum());
+	PutLE<unsigned int>(c.header, numSections);
+	unsigned long long offset = CONTAINER_PREFIX + numSections * CONTAINER_ENTRY;
+	auto putEntry = [&](unsigned int type, unsigned long long size, unsigned long long uncompressedSize, unsigned int checksum) {
+		offset = (offset + alignment - 1) / alignment * alignment;
+		c.offsets.push_back(offset);
+		PutLE<unsigned int>(c.header, type);
+		PutLE<unsigned long long>(c.header, offset);
+		PutLE<unsigned long long>(c.header, size);
+		PutLE<unsigned long long>(c.header, uncompressedSize);
+		PutLE<unsigned int>(c.header, checksum);
+		offset += size;
+	};
+	putEntry(SECTION_OPTIONS, c.options.size(), c.options.size(), Crc32c(c.options.data(), c.options.size()));
+	putEntry(SECTION_TOP, topSize, topSize, topChecksum);
+	for (unsigned int i = 0; i < p->GetNumSegments(); i++) {
+		auto& segment = p->GetSegment(i);
+		putEntry(SECTION_SEGMENT, segment.compressedSize, segment.uncompressedSize, segment.checksum);
+	}
+	c.fileSize = offset;
+	return c;
+}
+
+unsigned long long EstimateFileSize(Pyramid* p, unsigned int alignment) {
+	return BuildContainer(p, alignment).fileSize;
+}
+
+/*
+ * Rate control: with a target size, searches the finest uniform quantizer step
+ * whose file fits; otherwise the coarsest step that still meets the target
+ * PSNR. Both are monotone in the step, so a binary search over
+ * [1, MAX_QUANT_STEP] needs about log2(MAX_QUANT_STEP) encodes.
+ */
+Pyramid* CompressToTarget(KImage* image, CodecOptions options, double targetPSNR, unsigned long long targetSize, 
+		unsigned int alignment) {
+	int low = 1;
+	int high = MAX_QUANT_STEP;
+	Pyramid* best = nullptr;
+	while (low <= high) {
+		int step = (low + high) / 2;
+		options.quantSteps.assign(1, (unsigned char)step);
+		long double psnr;
+		Pyramid* p = Compress(image, options, &psnr);
+		bool ok = targetSize != 0 ? EstimateFileSize(p, alignment) <= targetSize : psnr >= targetPSNR;
+		if (ok) {
+			delete best;
+			best = p;
+		}
+		else {
+			delete p;
+		}
+		bool tryFiner = targetSize != 0 ? ok : !ok;
+		if (tryFiner) {
+			high = step - 1;
+		}
+		else {
+			low = step + 1;
+		}
+	}
+	if (best == nullptr) {
+		options.quantSteps.assign(1, (unsigned char)(targetSize != 0 ? MAX_QUANT_STEP : 1));
+		best = Compress(image, options);
+	}
+	return best;
+}
+
+bool DecodeBitPlanes(Pyramid* residual, const std::vector<unsigned char>& firstLayer, 
+	unsigned int offset, unsigned int numValues, unsigned char maxLayers, std::vector<short>& values, 
+	const std::atomic<bool>* cancel) {
+	auto& options = residual->GetOptions();
+	unsigned int numLayers = std::min<unsigned int>(maxLayers, residual->GetNumSegments());
+	values.assign(numValues, 0);
+	for (unsigned int layer = 0; layer < numLayers; layer++) {
+		std::vector<unsigned char> data;
+		if (layer == 0) {
+			data = firstLayer;
+		}
+		else if (!DecompressSegment(residual->GetSegment(layer), data, cancel)) {
+			return false;
+		}
+		unsigned int start = layer == 0 ? offset : 0;
+		BitVector bits(data.data() + start, (data.size() - start) * SIZE_UCHAR);
+		short planeValue = short(1 << (options.bitPlanes - 1 - layer));
+		unsigned int index = 0;
+		unsigned int numBits = bits.GetSize();
+		for (auto& v : values) {
+			if (index >= numBits) {
+				return false;
+			}
+			if (bits[index++] == 0) {
+				continue;
+			}
+			if (v == 0) {
+				if (index >= numBits) {
+					return false;
+				}
+				v = bits[index++] == 0 ? planeValue : -planeValue;
+			}
+			else {
+				v += v < 0 ? -planeValue : planeValue;
+			}
+		}
+	}
+
+	// Values missing their low planes are put in the middle of the interval
+	unsigned int missingPlanes = options.bitPlanes - numLayers;
+	if (missingPlanes != 0) {
+		short half = short(1 << (missingPlanes - 1));
+		for (auto& v : values) {
+			if (v != 0) {
+				v += v < 0 ? -half : half;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * Decodes up to maxLayers bit-plane layers and down to level, 0 being the
+ * full image and GetNumLevels() the top image; the coarser levels are
+ * reconstructed exactly as for a full decode. Returns nullptr when cancelled
+ * or when a segment does not decompress; Cancelled(cancel) tells them apart.
+ */
+KImage* Decompress(Pyramid* residual, unsigned char maxLayers, unsigned int level, 
+		const std::atomic<bool>* cancel) {
+	if (residual->GetOptions().transform == TRANSFORM_WAVELET53) {
+		return DecompressWavelet(residual, level, cancel);
+	}
+	auto dims = residual->GetDims();
+	auto& options = residual->GetOptions();
+	std::vector<unsigned char> data;
+	if (!DecompressSegment(residual->GetSegment(0), data, cancel)) {
+		return nullptr;
+	}
+	unsigned int size = data.size();
+	unsigned int offset = 0;
+
+	// Every count and offset read from the data is checked against its size
+	// before it is used, so damaged data fails the decode instead of reading
+	// or writing out of bounds
+	std::vector<unsigned int> positions;
+	BitVector signs;
+	if (options.bitPlanes == 0) {
+		if (size < sizeof(unsigned int)) {
+			return nullptr;
+		}
+		unsigned int numPositions = Read<unsigned int>(&data[0]);
+		offset = sizeof(unsigned int);
+		if (numPositions > (size - offset) / sizeof(unsigned int)) {
+			return nullptr;
+		}
+
+		positions.resize(numPositions);
+		if (numPositions != 0) {
+			std::memcpy(&positions[0], &data[offset], numPositions * sizeof(unsigned int));
+			offset += (numPositions * sizeof(unsigned int));
+		}
+
+		if ((numPositions + SIZE_UCHAR - 1) / SIZE_UCHAR > size - offset) {
+			return nullptr;
+		}
+		signs = BitVector(data.data() + offset, numPositions);
+		offset += signs.GetByteSize();
+	}
+
+	std::vector<std::pair<unsigned int, unsigned int>> dimVec;
+	for (unsigned int i = 0; i < residual->GetNumLevels(); i++) {
+		dimVec.push_back(dims);
+		dims = std::make_pair(residual->Downsample(dims.first), 
+			residual->Downsample(dims.second));
+	}
+
+	std::vector<std::vector<unsigned char>> levelFlags;
+	std::vector<unsigned int> levelSizes;
+	if (!ReadSignificanceMaps(data, offset, dimVec, options, levelFlags, levelSizes)) {
+		return nullptr;
+	}
+	unsigned long long codedSize = 0;
+	for (auto levelSize : levelSizes) {
+		codedSize += levelSize;
+	}
+	// One code per coded pixel, or at least one bit of the first layer
+	if (options.bitPlanes == 0 ? codedSize != size - offset : codedSize > (unsigned long long)(size - offset) * SIZE_UCHAR) {
+		return nullptr;
+	}
+	unsigned int totalSize = (unsigned int)codedSize;
+
+	std::vector<short> res;
+	unsigned int resOffset = offset;
+	if (options.bitPlanes != 0) {
+		if (!DecodeBitPlanes(residual, data, offset, totalSize, maxLayers, res, cancel)) {
+			return nullptr;
+		}
+	}
+	else if (options.predictor == PREDICT_NONE) {
+		res.resize(size - offset);
+		for (unsigned int i = offset; i < size; i++) {
+			res[i - offset] = (short)Read<unsigned char>(&data[i]) - MAX_CHAR;
+		}
+	}
+
+	for (auto el : positions) {
+		if (el >= res.size()) {
+			return nullptr;
+		}
+	}
+	unsigned int index = 0;
+	for (auto el : positions) {
+		res[el] += MAX_CHAR;
+		res[el] = signs[index++] == 0 ? res[el] : -res[el];
+	}
+
+	offset = totalSize;
+	KImage* pImage = residual->GetTopImage();
+	for (int li = int(dimVec.size()) - 1; li >= int(level); li--) {
+		if (Cancelled(cancel)) {
+			if (pImage != residual->GetTopImage()) {
+				delete pImage;
+			}
+			return nullptr;
+		}
+		auto dim = dimVec[li];
+		offset -= levelSizes[li];
+		KImage* upsampledImage = new KImage(dim.first, dim.second, SIZE_UCHAR);
+		unsigned char* flags = options.blockSize != 0 && !levelFlags[li].empty() ? &levelFlags[li][0] : nullptr;
+		unsigned char step = QuantStep(options, li);
+		bool predicted = options.predictor != PREDICT_NONE && options.bitPlanes == 0;
+		bool addResiduals = !LevelSkipped(options, li) && !predicted;
+
+		// Residual index of the first pixel of every row, so that row bands
+		// can be reconstructed independently
+		int width = dim.first;
+		int blockSize = flags != nullptr ? options.blockSize : width;
+		int blocksPerRow = (width + blockSize - 1) / blockSize;
+		std::vector<unsigned int> rowStart(dim.second + 1, offset);
+		for (unsigned int i = 0; addResiduals && i < dim.second; i++) {
+			rowStart[i + 1] = rowStart[i];
+			for (int b = 0; b < blocksPerRow; b++) {
+				if (flags == nullptr || flags[(i / blockSize) * blocksPerRow + b] != 0) {
+					rowStart[i + 1] += std::min((b + 1) * blockSize, width) - b * blockSize;
+				}
+			}
+		}
+
+		ParallelRows(dim.second, [&](int first, int last) {
+			ResampleRows(pImage, upsampledImage, LevelFilter(options, li), first, last);
+			if (!addResiduals) {
+				return;
+			}
+			auto imgData = upsampledImage->GetDataMatrix();
+			for (int i = first; i < last; i++) {
+				unsigned int k = rowStart[i];
+				for (int b = 0; b < blocksPerRow; b++) {
+					if (flags != nullptr && flags[(i / blockSize) * blocksPerRow + b] == 0) {
+						continue;
+					}
+					int start = b * blockSize;
+					int count = std::min((b + 1) * blockSize, width) - start;
+					ApplyResiduals(imgData[i] + start, &res[k], count, step);
+					k += count;
+				}
+			}
+		}, cancel);
+
+		// MED prediction runs through the rows in order
+		if (!LevelSkipped(options, li) && predicted && !Cancelled(cancel)) {
+			UnpredictResiduals(&data[resOffset + offset], upsampledImage, options.predictor, 
+				flags, options.blockSize, step);
+		}
+		if (pImage != residual->GetTopImage()) {
+			delete pImage;
+		}
+		pImage = upsampledImage;
+	}
+
+	// Bands skipped on cancel leave the last level incomplete
+	if (Cancelled(cancel)) {
+		if (pImage != residual->GetTopImage()) {
+			delete pImage;
+		}
+		return nullptr;
+	}
+	if (pImage == residual->GetTopImage()) {
+		return CopyImage(pImage);
+	}
+	return pImage;
+}
+
+/*
+ * The container as a list of buffers, in file order: header, options, top
+ * image rows and segments where they live, with zeros (at least alignment
+ * bytes of them) filling the gaps in front of aligned sections.
+ */
+std::vector<WriteBuffer> ContainerBuffers(Pyramid* p, const Container& c, const unsigned char* zeros) {
+	std::vector<WriteBuffer> buffers;
+	unsigned long long position = 0;
+	auto add = [&](const void* data, size_t size) {
+		WriteBuffer buffer = {data, size};
+		buffers.push_back(buffer);
+		position += size;
+	};
+	auto pad = [&](unsigned int section) {
+		if (c.offsets[section] > position) {
+			add(zeros, (size_t)(c.offsets[section] - position));
+		}
+	};
+	add(c.header.data(), c.header.size());
+	pad(0);
+	add(c.options.data(), c.options.size());
+	pad(1);
+	for (size_t i = 0; i < c.topRows.size(); i++) {
+		add(c.topRows[i], c.topWidth);
+	}
+	// Layers are written coarse to fine, so any prefix of the file decodes
+	for (unsigned int i = 0; i < p->GetNumSegments(); i++) {
+		auto& segment = p->GetSegment(i);
+		pad(2 + i);
+		add(segment.data, segment.compressedSize);
+	}
+	return buffers;
+}
+
+/*
+ * Writes the container with a single gathered write straight from where its
+ * parts live. The file is replaced atomically; with sync it is on disk on
+ * return.
+ */
+bool WriteCompressed(Pyramid* p, const std::wstring& file, unsigned int alignment, bool sync) {
+	Container c = BuildContainer(p, alignment);
+	std::vector<unsigned char> zeros(alignment, 0);
+	return WriteFileGathered(file, ContainerBuffers(p, c, zeros.data()), sync);
+}
+
+/*
+ * Top image rows are the only bytes copied out of a mapped file; KImage keeps
+ * its pixels in rows of its own.
+ */
+KImage* TopImageFrom(const unsigned char* data, unsigned int width, unsigned int height) {
+	KImage* topImg = new KImage(width, height, SIZE_UCHAR);
+	for (unsigned int i = 0; i < height; i++) {
+		std::memcpy(topImg->GetDataMatrix()[i], data + (size_t)i * width, width);
+	}
+	return topImg;
+}
+
+ResidualPyramid* MakePyramid(const std::vector<Segment>& segments, unsigned char numLevels, 
+		std::pair<unsigned int, unsigned int> dims, KImage* topImg, const CodecOptions& options) {
+	if (options.transform == TRANSFORM_WAVELET53) {
+		return new WaveletPyramid(segments, numLevels, dims, topImg, options);
+	}
+	return new ResidualPyramid(segments, numLevels, dims, topImg, options);
+}
+
+/*
+ * Parses a v2 container in memory. Returns nullptr for a damaged header,
+ * options or top image; segment data is checked by verify.
+ */
+ResidualPyramid* ReadContainer(const unsigned char* file, unsigned long long fileSize) {
+	if (fileSize < CONTAINER_PREFIX || file[3] != CONTAINER_VERSION) {
+		return nullptr;
+	}
+	unsigned int flags = GetLE<unsigned int>(file + 4);
+	unsigned int imageChecksum = GetLE<unsigned int>(file + 8);
+	unsigned int numSections = GetLE<unsigned int>(file + 12);
+	if (numSections < 2 || numSections > 2 + MAX_UCHAR || 
+		CONTAINER_PREFIX + numSections * CONTAINER_ENTRY > fileSize) {
+		return nullptr;
+	}
+	const unsigned char* table = file + CONTAINER_PREFIX;
+
+	auto section = [&](unsigned int index, unsigned long long& size) -> const unsigned char* {
+		const unsigned char* entry = table + index * CONTAINER_ENTRY;
+		unsigned long long offset = GetLE<unsigned long long>(entry + 4);
+		size = GetLE<unsigned long long>(entry + 12);
+		if (offset > fileSize || size > fileSize - offset) {
+			return nullptr;
+		}
+		return file + offset;
+	};
+	auto valid = [&](unsigned int index, unsigned int type, const unsigned char* data, unsigned long long size) {
+		const unsigned char* entry = table + index * CONTAINER_ENTRY;
+		return data != nullptr && GetLE<unsigned int>(entry) == type && 
+			Crc32c(data, (size_t)size) == GetLE<unsigned int>(entry + 28);
+	};
+	unsigned long long optionsSize;
+	unsigned long long topSize;
+	const unsigned char* optionsData = section(0, optionsSize);
+	const unsigned char* topData = section(1, topSize);
+	if (!valid(0, SECTION_OPTIONS, optionsData, optionsSize) || !valid(1, SECTION_TOP, topData, topSize) || optionsSize < 22) {
+		return nullptr;
+	}
+
+	CodecOptions options;
+	unsigned long long width = GetLE<unsigned long long>(optionsData);
+	unsigned long long height = GetLE<unsigned long long>(optionsData + 8);
+	unsigned char numLevels = optionsData[16];
+	options.predictor = optionsData[17];
+	options.blockSize = optionsData[18];
+	options.bitPlanes = optionsData[19];
+	options.transform = optionsData[20];
+	options.ratio = optionsData[21];
+	if (optionsSize != 22 + 2u * numLevels + 16) {
+		return nullptr;
+	}
+	options.quantSteps.assign(optionsData + 22, optionsData + 22 + numLevels);
+	options.filters.assign(optionsData + 22 + numLevels, optionsData + 22 + 2 * numLevels);
+	unsigned long long topWidth = GetLE<unsigned long long>(optionsData + 22 + 2 * numLevels);
+	unsigned long long topHeight = GetLE<unsigned long long>(optionsData + 30 + 2 * numLevels);
+	// The in-memory images use int dimensions. The top image is never larger
+	// than the image, which keeps topWidth * topHeight from overflowing.
+	if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX || 
+		topWidth == 0 || topHeight == 0 || topWidth > width || topHeight > height || topWidth * topHeight != topSize) {
+		return nullptr;
+	}
+
+	std::vector<Segment> segments;
+	for (unsigned int i = 2; i < numSections; i++) {
+		const unsigned char* entry = table + i * CONTAINER_ENTRY;
+		unsigned long long size;
+		const unsigned char* data = section(i, size);
+		unsigned long long uncompressedSize = GetLE<unsigned long long>(entry + 20);
+		// A truncated file still decodes from the layers that arrived whole
+		if (data == nullptr || GetLE<unsigned int>(entry) != SECTION_SEGMENT || size > UINT_MAX || uncompressedSize > UINT_MAX) {
+			break;
+		}
+		Segment segment;
+		segment.data = const_cast<unsigned char*>(data);
+		segment.compressedSize = (unsigned int)size;
+		segment.uncompressedSize = (unsigned int)uncompressedSize;
+		segment.checksum = GetLE<unsigned int>(entry + 28);
+		segments.push_back(segment);
+	}
+	if (segments.empty()) {
+		return nullptr;
+	}
+
+	ResidualPyramid* p = MakePyramid(segments, numLevels, std::make_pair((unsigned int)width, (unsigned int)height), 
+		TopImageFrom(topData, (unsigned int)topWidth, (unsigned int)topHeight), options);
+	if ((flags & FLAG_CHECKSUMS) != 0 && segments.size() == numSections - 2) {
+		p->SetImageChecksum(imageChecksum);
+	}
+	return p;
+}
+
+/*
+ * Host-endian PYX files, and PYR files from before the codec options, with
+ * the optional CRC trailer of PYX.
+ */
+ResidualPyramid* ReadLegacy(const unsigned char* file, unsigned long long fileSize) {
+	unsigned long long pos = 3;
+	auto take = [&](unsigned long long n) -> const unsigned char* {
+		if (n > fileSize - pos) {
+			return nullptr;
+		}
+		const unsigned char* data = file + pos;
+		pos += n;
+		return data;
+	};
+
+	bool pyx = std::memcmp(file, "PYX", 3) == 0;
+	if (!pyx && std::memcmp(file, "PYR", 3) != 0) {
+		return nullptr;
+	}
+	CodecOptions options;
+	unsigned char numSegments = 1;
+	Segment segment;
+	const unsigned char* header = take(2 * sizeof(unsigned int) + sizeof(unsigned char));
+	if (header == nullptr) {
+		return nullptr;
+	}
+	auto dimsOrig = std::make_pair(Read<unsigned int>(header), Read<unsigned int>(header + sizeof(unsigned int)));
+	unsigned char numLevels = header[2 * sizeof(unsigned int)];
+	if (pyx) {
+		const unsigned char* fields = take(6 + 2 * numLevels);
+		if (fields == nullptr) {
+			return nullptr;
+		}
+		options.predictor = fields[0];
+		options.blockSize = fields[1];
+		options.quantSteps.assign(fields + 2, fields + 2 + numLevels);
+		options.bitPlanes = fields[2 + numLevels];
+		options.transform = fields[3 + numLevels];
+		options.ratio = fields[4 + numLevels];
+		options.filters.assign(fields + 5 + numLevels, fields + 5 + 2 * numLevels);
+		numSegments = fields[5 + 2 * numLevels];
+	}
+	else {
+		options.blockSize = 0;
+		const unsigned char* sizes = take(2 * sizeof(unsigned int));
+		if (sizes == nullptr) {
+			return nullptr;
+		}
+		segment.compressedSize = Read<unsigned int>(sizes);
+		segment.uncompressedSize = Read<unsigned int>(sizes + sizeof(unsigned int));
+	}
+	const unsigned char* topDims = take(2 * sizeof(unsigned int));
+	if (topDims == nullptr) {
+		return nullptr;
+	}
+	unsigned int topWidth = Read<unsigned int>(topDims);
+	unsigned int topHeight = Read<unsigned int>(topDims + sizeof(unsigned int));
+	if (topWidth == 0 || topHeight == 0 || topWidth > dimsOrig.first || topHeight > dimsOrig.second || 
+		dimsOrig.first > INT_MAX || dimsOrig.second > INT_MAX) {
+		return nullptr;
+	}
+	const unsigned char* topData = take((unsigned long long)topWidth * topHeight);
+	if (topData == nullptr) {
+		return nullptr;
+	}
+
+	std::vector<Segment> segments;
+	for (unsigned int i = 0; i < numSegments; i++) {
+		if (pyx) {
+			const unsigned char* sizes = take(2 * sizeof(unsigned int));
+			if (sizes == nullptr) {
+				break;
+			}
+			segment.compressedSize = Read<unsigned int>(sizes);
+			segment.uncompressedSize = Read<unsigned int>(sizes + sizeof(unsigned int));
+		}
+		// A truncated file still decodes from the layers that arrived whole
+		const unsigned char* data = take(segment.compressedSize);
+		if (data == nullptr) {
+			break;
+		}
+		segment.data = const_cast<unsigned char*>(data);
+		segment.checksum = 0;
+		segments.push_back(segment);
+	}
+	if (segments.empty()) {
+		return nullptr;
+	}
+
+	const unsigned char* tag = segments.size() == numSegments && pyx ? take(3) : nullptr;
+	const unsigned char* checksums = tag != nullptr && std::memcmp(tag, "CRC", 3) == 0 ? 
+		take((1 + numSegments) * sizeof(unsigned int)) : nullptr;
+	if (checksums != nullptr) {
+		for (unsigned int i = 0; i < numSegments; i++) {
+			segments[i].checksum = Read<unsigned int>(checksums + (1 + i) * sizeof(unsigned int));
+		}
+	}
+
+	ResidualPyramid* p = MakePyramid(segments, numLevels, dimsOrig, TopImageFrom(topData, topWidth, topHeight), options);
+	if (checksums != nullptr) {
+		p->SetImageChecksum(Read<unsigned int>(checksums));
+	}
+	return p;
+}
+
+/*
+ * Checks the options and level sizes of a parsed pyramid against what the
+ * decoders rely on: known transform, predictor and filters, a bit-plane count
+ * that fits a short and covers the layers, and levels that shrink from the
+ * image, whose pixels fit 32-bit counts, down to exactly the top image.
+ */
+bool Consistent(Pyramid* p) {
+	auto& options = p->GetOptions();
+	if (options.transform > TRANSFORM_WAVELET53 || options.predictor > PREDICT_MED || options.ratio < MIN_RATIO ||
+		options.bitPlanes > MAX_BIT_PLANES || (options.bitPlanes != 0 && p->GetNumSegments() > options.bitPlanes)) {
+		return false;
+	}
+	for (auto filter : options.filters) {
+		if (filter >= NUMBER_OF_FILTERS) {
+			return false;
+		}
+	}
+	auto dims = p->GetDims();
+	if ((unsigned long long)dims.first * dims.second > UINT_MAX) {
+		return false;
+	}
+	for (unsigned int level = 0; level < p->GetNumLevels(); level++) {
+		if (dims.first == 0 || dims.second == 0) {
+			return false;
+		}
+		dims = std::make_pair(p->Downsample(dims.first), p->Downsample(dims.second));
+	}
+	KImage* topImage = p->GetTopImage();
+	return dims.first != 0 && dims.second != 0 && 
+		dims.first == (unsigned int)topImage->GetWidth() && dims.second == (unsigned int)topImage->GetHeight();
+}
+
+/*
+ * Maps the file and parses it in place: opening costs the header, and the
+ * decoders read the compressed segments straight from the page cache.
+ */
+ResidualPyramid* ParseCompressed(const unsigned char* data, unsigned long long size) {
+	if (data == nullptr || size < 3) {
+		return nullptr;
+	}
+	ResidualPyramid* p = std::memcmp(data, "PYV", 3) == 0 ? ReadContainer(data, size) : ReadLegacy(data, size);
+	if (p != nullptr && !Consistent(p)) {
+		// The segments point into data
+		p->SetBorrowed();
+		delete p;
+		return nullptr;
+	}
+	return p;
+}
+
+Pyramid* ReadCompressed(const std::wstring& file) {
+	std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>();
+	if (!mapping->Open(file)) {
+		return nullptr;
+	}
+	ResidualPyramid* p = ParseCompressed(mapping->GetData(), mapping->GetSize());
+	if (p != nullptr) {
+		p->SetMapping(mapping);
+	}
+	return p;
+}
+
@@ -0,0 +1,316 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Pyramid. Residual pyramid codec and .pyr container
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __PYRAMID__H__
+#define __PYRAMID__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "Direct_Access_Image.h"
+#include "Predict.h"
+#include "MappedFile.h"
+#include "FileWriter.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- The codec proper: a Laplacian residual pyramid (or a 5/3 wavelet) over an
+8-bit grayscale KImage, its residual segments compressed with bzip2, and the
+.pyr container those are stored in. Codec.cpp wraps it in the in-memory C
+API of Codec.h; the command line program adds batches, reports and
+benchmarks on top.
+
+- Compress returns a pyramid that owns its segments and top image;
+Decompress rebuilds the image, or a coarser level of it, from any pyramid.
+Both return nullptr when cancelled, and Decompress also on damaged data.
+
+- ParseCompressed reads the .pyr bytes where they are: the segments of the
+pyramid point into them, so they must outlive it, and SetBorrowed must be
+called before deleting it. ReadCompressed does the same over a mapping of
+the file, which the pyramid keeps alive itself.
+
+- The work inside one encode or decode (row bands, chains of levels) runs on
+CodecPool, one pool of hardware_concurrency threads shared with the async
+jobs of Codec.h, so concurrent jobs do not multiply the threads.
+
+*/
+
+//===========================================================================
+//===========================================================================
+#define SIZE_UCHAR		8
+#define MAX_UCHAR		255
+#define MIN_IMG_WIDTH	2
+#define MIN_IMG_HEIGHT	2
+#define SIG_BLOCK_SIZE	16
+#define MAX_QUANT_STEP	64
+#define PYRAMID_RATIO	3
+#define MIN_RATIO		2
+#define MIN_BAND_ROWS	16
+#define BANDS_PER_THREAD	4
+#define TRANSFORM_LANCZOS3	0
+#define TRANSFORM_WAVELET53	1
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+struct CodecOptions {
+	unsigned char predictor;
+	unsigned char blockSize;
+	std::vector<unsigned char> quantSteps;
+	unsigned char bitPlanes;
+	unsigned char transform;
+	unsigned char ratio;
+	std::vector<unsigned char> filters;
+	bool adaptiveLevels;
+	CodecOptions() :
+		predictor(PREDICT_NONE),
+		blockSize(SIG_BLOCK_SIZE),
+		bitPlanes(0),
+		transform(TRANSFORM_LANCZOS3),
+		ratio(PYRAMID_RATIO),
+		adaptiveLevels(false) {}
+};
+
+bool Cancelled(const std::atomic<bool>* cancel);
+ThreadPool& CodecPool();
+
+/*
+ * Splits [0, height) into row bands, a few per pool thread so that threads
+ * busy with other work leave their share to the rest, and runs
+ * body(first, last) on each through CodecPool().ParallelFor. Bands not
+ * started yet are skipped once cancel is set, so the caller must check it
+ * before using the rows.
+ */
+template <typename F>
+void ParallelRows(int height, F body, const std::atomic<bool>* cancel = nullptr) {
+	int numBands = std::min<int>(BANDS_PER_THREAD * (int)CodecPool().GetNumThreads(), 
+		(height + MIN_BAND_ROWS - 1) / MIN_BAND_ROWS);
+	if (numBands <= 1) {
+		body(0, height);
+		return;
+	}
+	int bandRows = (height + numBands - 1) / numBands;
+	CodecPool().ParallelFor((height + bandRows - 1) / bandRows, [&](size_t band) {
+		if (Cancelled(cancel)) {
+			return;
+		}
+		int first = (int)band * bandRows;
+		body(first, std::min(first + bandRows, height));
+	});
+}
+
+inline unsigned int ScaleDown(unsigned int dim, unsigned char ratio) {
+	return (unsigned int)(dim / float(ratio) + 0.5);
+}
+
+struct Segment {
+	unsigned char* data;
+	unsigned int compressedSize;
+	unsigned int uncompressedSize;
+	unsigned int checksum;
+};
+
+struct Pyramid {
+	virtual unsigned int GetNumSegments() const = 0;
+	virtual const Segment& GetSegment(unsigned int) const = 0;
+	virtual unsigned int GetCompressedSize() const = 0;
+	virtual unsigned char GetNumLevels() const = 0;
+	virtual const CodecOptions& GetOptions() const = 0;
+	virtual KImage* GetTopImage() const = 0;
+	virtual unsigned int Downsample(unsigned int) const = 0;
+	virtual std::pair<unsigned int, unsigned int> GetDims() const = 0;
+	virtual bool HasChecksums() const = 0;
+	virtual unsigned int GetImageChecksum() const = 0;
+	virtual const std::vector<double>& GetLevelEntropies() const = 0;
+	virtual ~Pyramid(){}
+};
+
+struct ResidualPyramid : public Pyramid {
+private:
+	std::vector<Segment> segments;
+	KImage* topImage;
+	unsigned char numLevels;
+	CodecOptions options;
+	std::pair<unsigned int, unsigned int> dims;
+	bool checksums;
+	unsigned int imageChecksum;
+	std::vector<double> levelEntropies;
+	std::shared_ptr<MappedFile> mapping;
+	bool borrowed;
+public:
+	ResidualPyramid() :
+		topImage(nullptr),
+		numLevels(0),
+		dims(std::make_pair(0, 0)),
+		checksums(false),
+		imageChecksum(0),
+		borrowed(false) {}
+
+	ResidualPyramid(const std::vector<Segment>& segs, unsigned char nl, 
+		std::pair<unsigned int, unsigned int> dims, KImage* topImg, const CodecOptions& opts = CodecOptions()) :
+		segments(segs),
+		topImage(topImg),
+		numLevels(nl),
+		options(opts),
+		dims(dims),
+		checksums(false),
+		imageChecksum(0),
+		borrowed(false) {}
+
+	unsigned int GetNumSegments() const override {
+		return segments.size();
+	}
+	const Segment& GetSegment(unsigned int index) const override {
+		return segments[index];
+	}
+	unsigned int GetCompressedSize() const override {
+		unsigned int size = 0;
+		for (auto& segment : segments) {
+			size += segment.compressedSize;
+		}
+		return size;
+	}
+	unsigned char GetNumLevels() const override {
+		return numLevels;
+	}
+	const CodecOptions& GetOptions() const override {
+		return options;
+	}
+	unsigned int Downsample(unsigned int dim) const override {
+		return ScaleDown(dim, options.ratio);
+	}
+	KImage* GetTopImage() const override {
+		return topImage;
+	}
+	std::pair<unsigned int, unsigned int> GetDims() const override {
+		return dims;
+	}
+	bool HasChecksums() const override {
+		return checksums;
+	}
+	unsigned int GetImageChecksum() const override {
+		return imageChecksum;
+	}
+	// Bits per pixel of every level's residual; only known to the encoder
+	const std::vector<double>& GetLevelEntropies() const override {
+		return levelEntropies;
+	}
+	void SetLevelEntropies(const std::vector<double>& entropies) {
+		levelEntropies = entropies;
+	}
+	// Checksum of the fully decoded image; segment checksums are always set
+	void SetImageChecksum(unsigned int checksum) {
+		checksums = true;
+		imageChecksum = checksum;
+	}
+	// Segments read from a file point into its mapping and live as long as it
+	void SetMapping(const std::shared_ptr<MappedFile>& file) {
+		mapping = file;
+	}
+	// Segments parsed from a caller's buffer, which must outlive the pyramid
+	void SetBorrowed() {
+		borrowed = true;
+	}
+	~ResidualPyramid() override {
+		for (auto& segment : segments) {
+			if (!mapping && !borrowed) {
+				delete[] segment.data;
+			}
+		}
+		if (topImage != nullptr) {
+			delete topImage;
+		}
+	}
+};
+
+struct WaveletPyramid : public ResidualPyramid {
+	WaveletPyramid() {}
+
+	WaveletPyramid(const std::vector<Segment>& segs, unsigned char nl, 
+		std::pair<unsigned int, unsigned int> dims, KImage* topImg, const CodecOptions& opts) :
+		ResidualPyramid(segs, nl, dims, topImg, opts) {}
+
+	unsigned int Downsample(unsigned int dim) const override {
+		return (dim + 1) / 2;
+	}
+};
+
+/*
+ * .pyr v2 container, all fields little-endian:
+ *
+ *   "PYV" version(u8) flags(u32) imageChecksum(u32) numSections(u32)
+ *   numSections x { type(u32) offset(u64) size(u64) uncompressedSize(u64) checksum(u32) }
+ *   section data
+ *
+ * The sections are the codec options (dimensions, per-level quantizer steps
+ * and filters, top image size), the raw top image and one entry per
+ * compressed segment, coarse to fine. Offsets are absolute, so a reader can
+ * seek straight to any section, and every section carries a CRC32C. With an
+ * alignment above 1 each section starts on a multiple of it, zero padded, so
+ * sections can be read with O_DIRECT or FILE_FLAG_NO_BUFFERING.
+ *
+ * The top image is not copied: topRows points at the rows of the pyramid's
+ * top image, which are written as they are.
+ *
+ * The format's sizes are 64-bit, but the codec behind it is not: images keep
+ * int dimensions and segments 32-bit sizes, so a file holds at most about
+ * 4 GB of residual data per segment and the readers reject anything larger.
+ */
+struct Container {
+	std::vector<unsigned char> header;
+	std::vector<unsigned char> options;
+	std::vector<const unsigned char*> topRows;
+	unsigned int topWidth;
+	std::vector<unsigned long long> offsets;
+	unsigned long long fileSize;
+};
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+Segment CompressSegment(const std::vector<unsigned char>& data, const std::atomic<bool>* cancel = nullptr);
+bool DecompressSegment(const Segment& segment, std::vector<unsigned char>& data, const std::atomic<bool>* cancel = nullptr);
+unsigned char QuantStep(const CodecOptions& options, unsigned int level);
+unsigned int ImageChecksum(KImage* image);
+double ResidualBits(KImage* image, KImage* upsampledImage);
+Pyramid* Compress(KImage* image, const CodecOptions& options = CodecOptions(), long double* psnr = nullptr, 
+	const std::atomic<bool>* cancel = nullptr);
+Pyramid* CompressToTarget(KImage* image, CodecOptions options, double targetPSNR, unsigned long long targetSize, 
+	unsigned int alignment = 1);
+KImage* Decompress(Pyramid* residual, unsigned char maxLayers = MAX_UCHAR, unsigned int level = 0, 
+	const std::atomic<bool>* cancel = nullptr);
+Container BuildContainer(Pyramid* p, unsigned int alignment = 1);
+unsigned long long EstimateFileSize(Pyramid* p, unsigned int alignment = 1);
+std::vector<WriteBuffer> ContainerBuffers(Pyramid* p, const Container& c, const unsigned char* zeros);
+bool WriteCompressed(Pyramid* p, const std::wstring& file, unsigned int alignment = 1, bool sync = false);
+ResidualPyramid* ParseCompressed(const unsigned char* data, unsigned long long size);
+Pyramid* ReadCompressed(const std::wstring& file);
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
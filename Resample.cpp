@@ -33,6 +33,20 @@ typedef struct
 //===========================================================================
 //===========================================================================
 
+//===========================================================================
+//===========================================================================
+static inline int ClampContributor(int intPixel, int intSize)
+{
+	// Mirroring alone leaves the range on sources narrower than the filter
+	if (intPixel < 0)
+		return 0;
+	if (intPixel >= intSize)
+		return intSize - 1;
+	return intPixel;
+}
+//===========================================================================
+//===========================================================================
+
 /*
  *
  *    ComputeXContribution()
@@ -108,7 +122,7 @@ static void ComputeXContribution(
 					k = i;
 
 			j = contributionX->intNumberOfContributors++;
-			contributionX->pContribution[j].intPixel = k;
+			contributionX->pContribution[j].intPixel = ClampContributor(k, intSourceWidth);
 			contributionX->pContribution[j].dblWeight = dblWeight;
 		}
 
@@ -137,7 +151,7 @@ static void ComputeXContribution(
 					k = i;
 
 			j = contributionX->intNumberOfContributors++;
-			contributionX->pContribution[j].intPixel = k;
+			contributionX->pContribution[j].intPixel = ClampContributor(k, intSourceWidth);
 			contributionX->pContribution[j].dblWeight = dblWeight;
 		}
 	}
@@ -155,10 +169,13 @@ static void ComputeXContribution(
 \param source The given source image
 \param destination The given destination image
 \param intFilterType The given filter type
+\param intFirstRow First destination row to compute
+\param intLastRow One past the last destination row to compute
 */
 //===========================================================================
 //===========================================================================
-static void Resample1Channel(KImage* source, KImage* destination, int intFilterType = 0)
+static void Resample1Channel(KImage* source, KImage* destination, int intFilterType,
+	int intFirstRow, int intLastRow)
 {
 	double* temporary;
 	double dblXScale, dblYScale;	        // Resample scale factors
@@ -173,8 +190,9 @@ static void Resample1Channel(KImage* source, KImage* destination, int intFilterT
 	KContributionArray ContributionX;
 	double(*FilterFunction)(double);
 	double dblFilterWidth;
+	int intFirstSourceRow, intLastSourceRow;	// source rows the band reads
 
-	if (intFilterType < 0 || intFilterType >= sizeof(Filters) / sizeof(Filter))
+	if (intFilterType < 0 || intFilterType >= int(sizeof(Filters) / sizeof(Filter)))
 		return;
 
 	FilterFunction = Filters[intFilterType].FilterFunction;
@@ -195,7 +213,7 @@ static void Resample1Channel(KImage* source, KImage* destination, int intFilterT
 	{
 		dblWidth = dblFilterWidth / dblYScale;
 		dblScale = 1.0 / dblYScale;
-		for (i = 0; i < destination->GetHeight(); i++)
+		for (i = intFirstRow; i < intLastRow; i++)
 		{
 			pContributionY[i].intNumberOfContributors = 0;
 			pContributionY[i].pContribution = new KContribution[(int)(dblWidth * 2 + 1)];
@@ -224,14 +242,14 @@ static void Resample1Channel(KImage* source, KImage* destination, int intFilterT
 					}
 
 				k = pContributionY[i].intNumberOfContributors++;
-				pContributionY[i].pContribution[k].intPixel = intPixelNumber;
+				pContributionY[i].pContribution[k].intPixel = ClampContributor(intPixelNumber, source->GetHeight());
 				pContributionY[i].pContribution[k].dblWeight = dblWeight;
 			}
 		}
 	}
 	else
 	{
-		for (i = 0; i < destination->GetHeight(); i++)
+		for (i = intFirstRow; i < intLastRow; i++)
 		{
 			pContributionY[i].intNumberOfContributors = 0;
 			pContributionY[i].pContribution = new KContribution[(int)(dblFilterWidth * 2 + 1)];
@@ -260,19 +278,30 @@ static void Resample1Channel(KImage* source, KImage* destination, int intFilterT
 					}
 
 				k = pContributionY[i].intNumberOfContributors++;
-				pContributionY[i].pContribution[k].intPixel = intPixelNumber;
+				pContributionY[i].pContribution[k].intPixel = ClampContributor(intPixelNumber, source->GetHeight());
 				pContributionY[i].pContribution[k].dblWeight = dblWeight;
 			}
 		}
 	}
 
+	intFirstSourceRow = source->GetHeight();
+	intLastSourceRow = 0;
+	for (i = intFirstRow; i < intLastRow; i++)
+		for (j = 0; j < pContributionY[i].intNumberOfContributors; j++)
+		{
+			if (pContributionY[i].pContribution[j].intPixel < intFirstSourceRow)
+				intFirstSourceRow = pContributionY[i].pContribution[j].intPixel;
+			if (pContributionY[i].pContribution[j].intPixel + 1 > intLastSourceRow)
+				intLastSourceRow = pContributionY[i].pContribution[j].intPixel + 1;
+		}
+
 	for (intXIndex = 0; intXIndex < destination->GetWidth(); intXIndex++)
 	{
 		ComputeXContribution(&ContributionX, dblXScale, dblFilterWidth,
 			destination->GetWidth(), source->GetWidth(), FilterFunction, intXIndex);
 
 		// Apply horizontal filter to make destination column in temporary.
-		for (k = 0; k < source->GetHeight(); k++)
+		for (k = intFirstSourceRow; k < intLastSourceRow; k++)
 		{
 			boolPixelDelta = false;
 			dblPixel1 = source->Get8BPPPixel(ContributionX.pContribution[0].intPixel, k);
@@ -306,7 +335,7 @@ static void Resample1Channel(KImage* source, KImage* destination, int intFilterT
 
 		// The temp column has been built. Now stretch it 
 		//   vertically into destination column.
-		for (i = 0; i < destination->GetHeight(); i++)
+		for (i = intFirstRow; i < intLastRow; i++)
 		{
 			boolPixelDelta = false;
 			dblPixel1 = temporary[pContributionY[i].pContribution[0].intPixel];
@@ -338,7 +367,7 @@ static void Resample1Channel(KImage* source, KImage* destination, int intFilterT
 	// next destination column
 	delete[] temporary;
 	// de-allocate the memory allocated for vertical filter weights
-	for (i = 0; i < destination->GetHeight(); i++)
+	for (i = intFirstRow; i < intLastRow; i++)
 		delete[] pContributionY[i].pContribution;
 	delete[] pContributionY;
 }
@@ -368,7 +397,39 @@ void Resample(KImage* pImageSource, KImage* pImageDestination, int intFilterType
 		return;
 	}
 
-	Resample1Channel(pImageSource, pImageDestination, intFilterType);
+	Resample1Channel(pImageSource, pImageDestination, intFilterType, 0, pImageDestination->GetHeight());
+}
+//===========================================================================
+//===========================================================================
+
+/*
+ *
+ *    ResampleRows(...) - Resamples a band of destination rows.
+ *
+ *    Observations: every destination row only depends on the source, so
+ *    disjoint bands can be computed concurrently and match Resample exactly
+ *
+ */
+//! Resamples the destination rows [intFirstRow, intLastRow)
+/*!
+\param pImageSource The given image source
+\param pImageDestination The image destination
+\param intFilterType The given filter type
+\param intFirstRow First destination row to compute
+\param intLastRow One past the last destination row to compute
+*/
+//===========================================================================
+//===========================================================================
+void ResampleRows(KImage* pImageSource, KImage* pImageDestination, int intFilterType,
+	int intFirstRow, int intLastRow)
+{
+	if (pImageSource->GetBPP() != 8 || pImageDestination->GetBPP() != 8)
+	{
+		assert(false);
+		return;
+	}
+
+	Resample1Channel(pImageSource, pImageDestination, intFilterType, intFirstRow, intLastRow);
 }
 //===========================================================================
 //===========================================================================
@@ -394,7 +455,7 @@ long double MSE(KImage* pImageSource, KImage* pImageDestination)
 			dblSquareSum += intDelta * intDelta;
 		}
 
-	return dblSquareSum / (long double(pImageSource->GetWidth()) * long double(pImageSource->GetHeight()));
+	return dblSquareSum / ((long double)pImageSource->GetWidth() * (long double)pImageSource->GetHeight());
 }
 //===========================================================================
 //===========================================================================
@@ -406,7 +467,7 @@ long double PSNR(long double dblMSE)
 	//Maximum may be reached at 144.52dB for two 64K x 64K 8BPP images differing by 1 pixel-value
 	if (dblMSE == 0.0)
 		return 150.0;
-	return 10.0 * log10(long double(255.0) * long double(255.0) / dblMSE);
+	return 10.0 * log10((long double)255.0 * (long double)255.0 / dblMSE);
 }
 //===========================================================================
 //===========================================================================
@@ -274,6 +274,8 @@ static Filter Filters[] =
 //===========================================================================
 //===========================================================================
 void Resample(KImage* pImageSource, KImage* pImageDestination, int intFilterType);
+void ResampleRows(KImage* pImageSource, KImage* pImageDestination, int intFilterType,
+	int intFirstRow, int intLastRow);
 long double MSE(KImage* pImageSource, KImage* pImageDestination);
 long double PSNR(long double dblMSE);
 //===========================================================================
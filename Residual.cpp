@@ -0,0 +1,128 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Residual. Vectorized residual compute and apply kernels
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "Residual.h"
+
+#include <algorithm>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RESIDUAL_SSE2
+#endif
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#define RESIDUAL_LANES		32
+#define RESIDUAL_MAX		255
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static inline int CountBits(unsigned int intMask)
+{
+	int intCount = 0;
+	for (; intMask != 0; intMask &= intMask - 1)
+		intCount++;
+	return intCount;
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void ComputeResiduals(const BYTE* pOriginal, const BYTE* pUpsampled, int intCount, short* pResidual)
+{
+	int x = 0;
+#ifdef RESIDUAL_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + RESIDUAL_LANES <= intCount; x += RESIDUAL_LANES)
+	{
+		for (int intHalf = 0; intHalf < RESIDUAL_LANES; intHalf += 16)
+		{
+			__m128i o = _mm_loadu_si128((const __m128i*)(pOriginal + x + intHalf));
+			__m128i u = _mm_loadu_si128((const __m128i*)(pUpsampled + x + intHalf));
+			_mm_storeu_si128((__m128i*)(pResidual + x + intHalf),
+				_mm_sub_epi16(_mm_unpacklo_epi8(o, zero), _mm_unpacklo_epi8(u, zero)));
+			_mm_storeu_si128((__m128i*)(pResidual + x + intHalf + 8),
+				_mm_sub_epi16(_mm_unpackhi_epi8(o, zero), _mm_unpackhi_epi8(u, zero)));
+		}
+	}
+#endif
+	for (; x < intCount; x++)
+		pResidual[x] = short(pOriginal[x] - pUpsampled[x]);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+int BiasResiduals(const short* pResidual, int intCount, unsigned char* pCodes)
+{
+	int intEscapes = 0;
+	int x = 0;
+#ifdef RESIDUAL_SSE2
+	const __m128i bias = _mm_set1_epi16(RESIDUAL_BIAS);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i high = _mm_set1_epi16(RESIDUAL_MAX);
+	for (; x + RESIDUAL_LANES <= intCount; x += RESIDUAL_LANES)
+	{
+		for (int intHalf = 0; intHalf < RESIDUAL_LANES; intHalf += 16)
+		{
+			__m128i v0 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(pResidual + x + intHalf)), bias);
+			__m128i v1 = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(pResidual + x + intHalf + 8)), bias);
+			__m128i e0 = _mm_or_si128(_mm_cmpgt_epi16(v0, high), _mm_cmplt_epi16(v0, zero));
+			__m128i e1 = _mm_or_si128(_mm_cmpgt_epi16(v1, high), _mm_cmplt_epi16(v1, zero));
+			intEscapes += CountBits(_mm_movemask_epi8(_mm_packs_epi16(e0, e1)));
+			_mm_storeu_si128((__m128i*)(pCodes + x + intHalf), _mm_packus_epi16(v0, v1));
+		}
+	}
+#endif
+	for (; x < intCount; x++)
+	{
+		int intCode = pResidual[x] + RESIDUAL_BIAS;
+		if (intCode < 0 || intCode > RESIDUAL_MAX)
+			intEscapes++;
+		pCodes[x] = (unsigned char)std::max(0, std::min(RESIDUAL_MAX, intCode));
+	}
+	return intEscapes;
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void ApplyResiduals(BYTE* pPixels, const short* pResidual, int intCount, int intStep)
+{
+	int x = 0;
+#ifdef RESIDUAL_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i step = _mm_set1_epi16((short)intStep);
+	for (; x + RESIDUAL_LANES <= intCount; x += RESIDUAL_LANES)
+	{
+		for (int intHalf = 0; intHalf < RESIDUAL_LANES; intHalf += 16)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)(pPixels + x + intHalf));
+			__m128i r0 = _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(pResidual + x + intHalf)), step);
+			__m128i r1 = _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(pResidual + x + intHalf + 8)), step);
+			__m128i v0 = _mm_add_epi16(_mm_unpacklo_epi8(p, zero), r0);
+			__m128i v1 = _mm_add_epi16(_mm_unpackhi_epi8(p, zero), r1);
+			_mm_storeu_si128((__m128i*)(pPixels + x + intHalf), _mm_packus_epi16(v0, v1));
+		}
+	}
+#endif
+	for (; x < intCount; x++)
+		pPixels[x] = (BYTE)std::max(0, std::min(RESIDUAL_MAX, pPixels[x] + pResidual[x] * intStep));
+}
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,61 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Residual. Vectorized residual compute and apply kernels
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __RESIDUAL__H__
+#define __RESIDUAL__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "Direct_Access_Image.h"
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- The kernels work on spans of one row (a whole row, or one block of a row
+when a significance map is used) and write into buffers the caller has
+already sized, so the per-pixel loops have no branches and no allocation.
+
+- With SSE2, 32 pixels are handled per iteration: bytes are widened to 16 bit,
+combined, and narrowed back with unsigned saturation. A scalar tail finishes
+the span.
+
+- BiasResiduals stores residual + 128 and counts the residuals that do not fit
+a byte. Their codes are saturated placeholders; the caller rewrites them as
+escapes, which is rare enough to stay scalar.
+
+- ApplyResiduals adds residual * step to the upsampled pixels and saturates
+to [0, 255]. For lossless levels the result is exact, for quantized ones it
+is the clamp the encoder applied in its closed loop.
+
+*/
+
+//===========================================================================
+//===========================================================================
+#define RESIDUAL_BIAS		128
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void ComputeResiduals(const BYTE* pOriginal, const BYTE* pUpsampled, int intCount, short* pResidual);
+int BiasResiduals(const short* pResidual, int intCount, unsigned char* pCodes);
+void ApplyResiduals(BYTE* pPixels, const short* pResidual, int intCount, int intStep);
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
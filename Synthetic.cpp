@@ -0,0 +1,231 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Synthetic. Deterministic test images of any size, row by row
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "Synthetic.h"
+
+#include <vector>
+#include <cstring>
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#define TEXT_DOT			2
+#define TEXT_GLYPH_WIDTH	5
+#define TEXT_GLYPH_HEIGHT	7
+#define TEXT_CELL_WIDTH		((TEXT_GLYPH_WIDTH + 1) * TEXT_DOT)
+#define TEXT_LINE_HEIGHT	((TEXT_GLYPH_HEIGHT + 5) * TEXT_DOT)
+#define TEXT_PAPER			236
+#define TEXT_INK			24
+#define PHOTO_OCTAVES		6
+#define PHOTO_PERIOD		512
+#define PHOTO_CONTRAST		400.0
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static const wchar_t* PatternNames[NUMBER_OF_SYNTHETIC] = { L"gradient", L"noise", L"text", L"photo" };
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+// splitmix64 finalizer
+static inline unsigned long long Mix(unsigned long long x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static inline unsigned long long Hash(unsigned long long intSeed, unsigned long long x, unsigned long long y,
+	unsigned long long intSalt)
+{
+	return Mix(intSeed ^ Mix(x * 0x9E3779B97F4A7C15ULL + Mix(y ^ (intSalt << 56))));
+}
+
+static inline double Smooth(double t)
+{
+	return t * t * (3.0 - 2.0 * t);
+}
+
+static inline unsigned char ClampByte(double dblValue)
+{
+	return dblValue <= 0 ? 0 : dblValue >= 255 ? 255 : (unsigned char)(dblValue + 0.5);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+SyntheticImage::SyntheticImage(int intPattern, unsigned int intWidth, unsigned int intHeight, unsigned long long intSeed) :
+	intPattern(intPattern), intWidth(intWidth), intHeight(intHeight), intSeed(intSeed)
+{
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void SyntheticImage::GenerateRow(unsigned int intY, unsigned char* pRow) const
+{
+	switch (intPattern)
+	{
+	case SYNTHETIC_GRADIENT:
+		GradientRow(intY, pRow);
+		break;
+	case SYNTHETIC_NOISE:
+		NoiseRow(intY, pRow);
+		break;
+	case SYNTHETIC_TEXT:
+		TextRow(intY, pRow);
+		break;
+	default:
+		PhotoRow(intY, pRow);
+		break;
+	}
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void SyntheticImage::GradientRow(unsigned int intY, unsigned char* pRow) const
+{
+	double dblX = intWidth > 1 ? 0.6 * 255 / (intWidth - 1) : 0;
+	double dblY = intHeight > 1 ? 0.4 * 255 * intY / (intHeight - 1) : 0;
+	for (unsigned int x = 0; x < intWidth; x++)
+		pRow[x] = ClampByte(dblY + dblX * x);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void SyntheticImage::NoiseRow(unsigned int intY, unsigned char* pRow) const
+{
+	// Eight pixels per hash
+	for (unsigned int x = 0; x < intWidth; x += 8)
+	{
+		unsigned long long intBits = Hash(intSeed, x / 8, intY, SYNTHETIC_NOISE);
+		for (unsigned int i = 0; i < 8 && x + i < intWidth; i++)
+			pRow[x + i] = (unsigned char)(intBits >> (8 * i));
+	}
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void SyntheticImage::TextRow(unsigned int intY, unsigned char* pRow) const
+{
+	std::memset(pRow, TEXT_PAPER, intWidth);
+	unsigned int intLine = intY / TEXT_LINE_HEIGHT;
+	unsigned int intDotRow = (intY % TEXT_LINE_HEIGHT) / TEXT_DOT;
+	// Leading between lines, and an empty line between paragraphs
+	if (intDotRow >= TEXT_GLYPH_HEIGHT || Hash(intSeed, 0, intLine, SYNTHETIC_TEXT) % 8 == 0)
+		return;
+
+	unsigned int intMargin = intWidth / 16;
+	unsigned int intCells = (intWidth - 2 * intMargin) / TEXT_CELL_WIDTH;
+	for (unsigned int c = 0; c < intCells; c++)
+	{
+		// One glyph per cell: 35 dots, of which about a third are inked,
+		// and one cell in eight a space between words
+		unsigned long long intGlyph = Hash(intSeed, c, intLine, SYNTHETIC_TEXT);
+		if ((intGlyph & 7) == 0)
+			continue;
+		unsigned long long intMask = Hash(intSeed, c, intLine, SYNTHETIC_TEXT + 1);
+		unsigned long long intDots = (intGlyph >> 3) & (intMask | (intMask >> 29));
+		unsigned int intBits = (unsigned int)(intDots >> (intDotRow * TEXT_GLYPH_WIDTH));
+		unsigned char* pCell = pRow + intMargin + c * TEXT_CELL_WIDTH;
+		for (unsigned int d = 0; d < TEXT_GLYPH_WIDTH; d++)
+		{
+			if ((intBits >> d) & 1)
+				std::memset(pCell + d * TEXT_DOT, TEXT_INK, TEXT_DOT);
+		}
+	}
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void SyntheticImage::PhotoRow(unsigned int intY, unsigned char* pRow) const
+{
+	// Octaves are summed over the whole row, so each lattice corner is hashed
+	// once per cell rather than once per pixel
+	std::vector<double> vecSum(intWidth, 0.0);
+	double dblAmplitude = 1.0;
+	double dblNorm = 0.0;
+	for (unsigned int o = 0; o < PHOTO_OCTAVES; o++)
+	{
+		unsigned int intPeriod = PHOTO_PERIOD >> o;
+		unsigned long long intCellY = intY / intPeriod;
+		double dblFy = Smooth(double(intY % intPeriod) / intPeriod);
+		const double dblScale = 1.0 / 9007199254740992.0;
+		unsigned long long intCellX = ~0ULL;
+		double dblTop = 0, dblBottom = 0, dblTopNext = 0, dblBottomNext = 0;
+		for (unsigned int x = 0; x < intWidth; x++)
+		{
+			if (x / intPeriod != intCellX)
+			{
+				intCellX = x / intPeriod;
+				dblTop = (Hash(intSeed, intCellX, intCellY, SYNTHETIC_PHOTO + o) >> 11) * dblScale;
+				dblTopNext = (Hash(intSeed, intCellX + 1, intCellY, SYNTHETIC_PHOTO + o) >> 11) * dblScale;
+				dblBottom = (Hash(intSeed, intCellX, intCellY + 1, SYNTHETIC_PHOTO + o) >> 11) * dblScale;
+				dblBottomNext = (Hash(intSeed, intCellX + 1, intCellY + 1, SYNTHETIC_PHOTO + o) >> 11) * dblScale;
+			}
+			double dblFx = Smooth(double(x % intPeriod) / intPeriod);
+			double dblUpper = dblTop + (dblTopNext - dblTop) * dblFx;
+			double dblLower = dblBottom + (dblBottomNext - dblBottom) * dblFx;
+			vecSum[x] += dblAmplitude * (dblUpper + (dblLower - dblUpper) * dblFy);
+		}
+		dblNorm += dblAmplitude;
+		dblAmplitude *= 0.5;
+	}
+
+	// Sensor grain of +-2 levels
+	for (unsigned int x = 0; x < intWidth; x += 16)
+	{
+		unsigned long long intGrain = Hash(intSeed, x / 16, intY, SYNTHETIC_PHOTO + PHOTO_OCTAVES);
+		for (unsigned int i = 0; i < 16 && x + i < intWidth; i++)
+		{
+			double dblValue = 128.0 + (vecSum[x + i] / dblNorm - 0.5) * PHOTO_CONTRAST;
+			pRow[x + i] = ClampByte(dblValue + int((intGrain >> (4 * i)) % 5) - 2);
+		}
+	}
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+int ParseSyntheticPattern(const std::wstring& strName)
+{
+	for (int i = 0; i < NUMBER_OF_SYNTHETIC; i++)
+	{
+		if (strName == PatternNames[i])
+			return i;
+	}
+	return -1;
+}
+
+const wchar_t* SyntheticPatternName(int intPattern)
+{
+	return intPattern >= 0 && intPattern < NUMBER_OF_SYNTHETIC ? PatternNames[intPattern] : L"";
+}
+//===========================================================================
+//===========================================================================
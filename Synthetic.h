@@ -0,0 +1,104 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Synthetic. Deterministic test images of any size, row by row
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __SYNTHETIC__H__
+#define __SYNTHETIC__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <string>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- Every pixel is a pure function of the pattern, the seed and its
+coordinates, so any row can be generated on its own, in any order and on
+any thread, and the same arguments give the same bytes on every machine.
+An image of any size (up to 2^32 - 1 on each side) can be streamed with one
+row of memory.
+
+- Patterns, chosen to stress the codec differently:
+	gradient	smooth two-axis ramp; residuals are almost all zero
+	noise		uniform random bytes; incompressible, worst case
+	text		dark glyph strokes on a light page; sharp edges, flat areas
+	photo		fractal value noise (6 octaves) with grain; smooth areas,
+				texture at every scale, like a natural photograph
+
+- Coordinates are hashed with 64-bit arithmetic and the lattice periods of
+the fractal are powers of two, so the patterns do not repeat or lose
+precision at gigapixel sizes.
+
+*/
+
+//===========================================================================
+//===========================================================================
+#define SYNTHETIC_GRADIENT		0
+#define SYNTHETIC_NOISE			1
+#define SYNTHETIC_TEXT			2
+#define SYNTHETIC_PHOTO			3
+#define NUMBER_OF_SYNTHETIC		4
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+class SyntheticImage
+{
+private:
+	int intPattern;
+	unsigned int intWidth;
+	unsigned int intHeight;
+	unsigned long long intSeed;
+
+	void GradientRow(unsigned int intY, unsigned char* pRow) const;
+	void NoiseRow(unsigned int intY, unsigned char* pRow) const;
+	void TextRow(unsigned int intY, unsigned char* pRow) const;
+	void PhotoRow(unsigned int intY, unsigned char* pRow) const;
+
+public:
+	SyntheticImage(int intPattern, unsigned int intWidth, unsigned int intHeight, unsigned long long intSeed = 1);
+
+	// Writes the intWidth pixels of row intY
+	void GenerateRow(unsigned int intY, unsigned char* pRow) const;
+
+	//===========================================================================
+	//===========================================================================
+	unsigned int GetWidth() const
+	{
+		return intWidth;
+	}
+
+	//===========================================================================
+	//===========================================================================
+	unsigned int GetHeight() const
+	{
+		return intHeight;
+	}
+};
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+// Pattern by name ("gradient", "noise", "text", "photo"), -1 if unknown
+int ParseSyntheticPattern(const std::wstring& strName);
+const wchar_t* SyntheticPatternName(int intPattern);
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,151 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  ThreadPool. Fixed set of worker threads for background jobs
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <exception>
+#include <algorithm>
+//===========================================================================
+//===========================================================================
+
+// Items of one ParallelFor. Helpers may start after the call returned, when
+// all items are taken, so they share this state but never touch the body
+// unless they took an item.
+struct ParallelItems
+{
+	std::atomic<size_t> intNext;
+	size_t intCount;
+	const std::function<void(size_t)>* pBody;
+	std::mutex mutexDone;
+	std::condition_variable condDone;
+	size_t intDone;
+	std::exception_ptr pError;
+
+	ParallelItems(size_t intItems, const std::function<void(size_t)>* pFunction) :
+		intNext(0), intCount(intItems), pBody(pFunction), intDone(0) {}
+};
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static void RunItems(ParallelItems& items)
+{
+	size_t intRan = 0;
+	std::exception_ptr pError;
+	for (size_t i = items.intNext++; i < items.intCount; i = items.intNext++)
+	{
+		try
+		{
+			(*items.pBody)(i);
+		}
+		catch (...)
+		{
+			if (!pError)
+				pError = std::current_exception();
+		}
+		intRan++;
+	}
+	if (intRan == 0)
+		return;
+	std::lock_guard<std::mutex> lock(items.mutexDone);
+	if (pError && !items.pError)
+		items.pError = pError;
+	items.intDone += intRan;
+	if (items.intDone == items.intCount)
+		items.condDone.notify_all();
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+ThreadPool::ThreadPool(unsigned int intThreads) : boolStopping(false)
+{
+	if (intThreads == 0)
+		intThreads = 1;
+	for (unsigned int i = 0; i < intThreads; i++)
+		vecWorkers.push_back(std::thread(&ThreadPool::Work, this));
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutexJobs);
+		boolStopping = true;
+	}
+	condJobs.notify_all();
+	for (size_t i = 0; i < vecWorkers.size(); i++)
+		vecWorkers[i].join();
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void ThreadPool::Submit(const std::function<void()>& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutexJobs);
+		queJobs.push_back(job);
+	}
+	condJobs.notify_one();
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void ThreadPool::Work()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutexJobs);
+			while (queJobs.empty() && !boolStopping)
+				condJobs.wait(lock);
+			if (queJobs.empty())
+				return;
+			job = queJobs.front();
+			queJobs.pop_front();
+		}
+		job();
+	}
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void ThreadPool::ParallelFor(size_t intCount, const std::function<void(size_t)>& body)
+{
+	if (intCount == 0)
+		return;
+	std::shared_ptr<ParallelItems> pItems = std::make_shared<ParallelItems>(intCount, &body);
+	size_t intHelpers = std::min(intCount - 1, vecWorkers.size());
+	for (size_t i = 0; i < intHelpers; i++)
+		Submit([pItems]() { RunItems(*pItems); });
+	RunItems(*pItems);
+
+	std::unique_lock<std::mutex> lock(pItems->mutexDone);
+	while (pItems->intDone != intCount)
+		pItems->condDone.wait(lock);
+	if (pItems->pError)
+		std::rethrow_exception(pItems->pError);
+}
+//===========================================================================
+//===========================================================================
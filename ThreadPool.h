@@ -0,0 +1,92 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  ThreadPool. Fixed set of worker threads for background jobs
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __THREADPOOL__H__
+#define __THREADPOOL__H__
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- Submit queues a job and returns at once; the workers take jobs in
+submission order. The queue is unbounded, so submitting never blocks the
+caller, unlike the pipeline's BoundedQueue whose blocking is the point.
+
+- Jobs are whole encodes or decodes, seconds of work each, or helpers of
+ParallelFor that take several of its items each, so a mutex and a condition
+variable around a deque cost nothing measurable.
+
+- ParallelFor runs body(0) to body(count - 1) and returns when all have run.
+The calling thread takes items itself, and idle workers help through jobs
+queued behind the others; so work split this way from inside a job only
+uses workers that would otherwise wait, never more threads than the pool
+has, and cannot deadlock: with every worker busy, the caller runs all the
+items alone. An exception from body is rethrown to the caller once the
+items that started have finished.
+
+- The destructor lets the workers finish every queued job and joins them.
+
+- Other than through ParallelFor, jobs must not wait for other jobs of the
+same pool: with every worker waiting, the jobs they wait for would never
+run.
+
+*/
+
+//===========================================================================
+//===========================================================================
+class ThreadPool
+{
+private:
+	std::mutex mutexJobs;
+	std::condition_variable condJobs;
+	std::deque<std::function<void()>> queJobs;
+	std::vector<std::thread> vecWorkers;
+	bool boolStopping;
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void Work();
+
+public:
+	ThreadPool(unsigned int intThreads);
+	~ThreadPool();
+
+	void Submit(const std::function<void()>& job);
+	void ParallelFor(size_t intCount, const std::function<void(size_t)>& body);
+
+	//===========================================================================
+	//===========================================================================
+	size_t GetNumThreads() const
+	{
+		return vecWorkers.size();
+	}
+};
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
@@ -1,439 +1,1430 @@
 #include "stdafx.h"
 #include "Direct_Access_Image.h"
 #include "Resample.h"
+#include "Predict.h"
+#include "Residual.h"
+#include "BitVector.h"
+#include "BoundedQueue.h"
+#include "FileScan.h"
+#include "Checksum.h"
+#include "Pyramid.h"
+#include "ProcessStats.h"
+#include "Synthetic.h"
 
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <cassert>
+#include <climits>
 #include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <cstdlib>
+#include <iomanip>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <clocale>
+#include <stdexcept>
 
-#define SIZE_UCHAR		8
-#define MAX_CHAR		128
-#define MAX_UCHAR		255
-#define MASK_1			0x01
-#define M_BZ_SMALL		0
-#define M_BZ_VERB		0
-#define M_BZ_BLK_SIZE	9
-#define M_BZ_WORK_FACT	0
-#define MIN_IMG_WIDTH	2
-#define MIN_IMG_HEIGHT	2
-
-template <typename U, typename T>
-void Write(U* buf, T val) {
-	*reinterpret_cast<T*>(buf) = val;
+#define MAX_SEARCH_RATIO	4
+#define WORKING_BYTES_PER_PIXEL	12
+#define PIPELINE_QUEUE_PER_JOB	2
+
+void TestPrintFile(unsigned char* d, unsigned int size, const std::string& file) {
+	std::ofstream out(file);
+	for (unsigned int i = 0; i < size; i++) {
+		out << (int)d[i] << "\n";
+	}
+	out.close();
 }
 
-template <typename T, typename U>
-T Read(U* buf) {
-	return *reinterpret_cast<T*>(buf);
+unsigned long long FileSize(const std::wstring& file) {
+	std::ifstream in(StreamPath(file), std::ios::binary | std::ios::ate);
+	return in.good() ? (unsigned long long)in.tellg() : 0;
 }
 
-template <typename T>
-void TestPrint(T* vec, unsigned int num) {
-	for (unsigned int i = 0; i < num; i++) {
-		std::cout << std::forward<T>(vec[i]) << "\n";
-	}
+double ElapsedMs(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 }
 
-struct BitVector {
-private:
-	std::vector<unsigned char> vec;
-	unsigned int size;
-public:
-	BitVector() : size(0) {}
-	BitVector(std::vector<unsigned char> data, unsigned int size) : 
-		size(size),
-		vec(data)
-	{}
+/*
+ * Encoder search: for every candidate ratio the filter of each level is
+ * picked greedily by the zeroth-order entropy of its residual, with all
+ * filters of a level evaluated in parallel on the codec pool. The ratio with the lowest
+ * estimated size (residual entropy plus the raw top image) wins. Past
+ * budgetMs of wall-clock time the search keeps the best complete candidate.
+ */
+CodecOptions SearchFilters(KImage* image, const CodecOptions& options, double budgetMs) {
+	if (options.transform != TRANSFORM_LANCZOS3) {
+		return options;
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	CodecOptions best = options;
+	double bestBits = -1;
+	for (unsigned char ratio = MIN_RATIO; ratio <= MAX_SEARCH_RATIO; ratio++) {
+		CodecOptions candidate = options;
+		candidate.ratio = ratio;
+		candidate.filters.clear();
+		double bits = 0;
+		bool complete = true;
+		KImage* current = image;
+		while (true) {
+			unsigned int newWidth = ScaleDown(current->GetWidth(), ratio);
+			unsigned int newHeight = ScaleDown(current->GetHeight(), ratio);
+			if (newWidth <= MIN_IMG_WIDTH || newHeight <= MIN_IMG_HEIGHT) {
+				break;
+			}
+			if (bestBits >= 0 && ElapsedMs(start) > budgetMs) {
+				complete = false;
+				break;
+			}
 
-	void Add(unsigned char sign) {
-		if (size % SIZE_UCHAR == 0) {
-			vec.push_back(0);
+			std::vector<KImage*> downsampled(NUMBER_OF_FILTERS);
+			std::vector<double> filterBits(NUMBER_OF_FILTERS);
+			CodecPool().ParallelFor(NUMBER_OF_FILTERS, [&](size_t f) {
+				downsampled[f] = new KImage(newWidth, newHeight, SIZE_UCHAR);
+				Resample(current, downsampled[f], (int)f);
+				KImage upsampledImage(current->GetWidth(), current->GetHeight(), SIZE_UCHAR);
+				Resample(downsampled[f], &upsampledImage, (int)f);
+				filterBits[f] = ResidualBits(current, &upsampledImage);
+			});
+
+			unsigned char winner = (unsigned char)(std::min_element(filterBits.begin(), filterBits.end()) - filterBits.begin());
+			candidate.filters.push_back(winner);
+			bits += filterBits[winner];
+			for (unsigned int f = 0; f < NUMBER_OF_FILTERS; f++) {
+				if (f != winner) {
+					delete downsampled[f];
+				}
+			}
+			if (current != image) {
+				delete current;
+			}
+			current = downsampled[winner];
+		}
+		bits += double(current->GetWidth()) * current->GetHeight() * SIZE_UCHAR;
+		if (current != image) {
+			delete current;
 		}
-		unsigned char& byte = vec.back();
-		byte |= (sign << (SIZE_UCHAR - (size % SIZE_UCHAR + 1)));
-		size++;
-	}
 
-	unsigned char operator[](int index) {
-		unsigned int byteIndex = index / SIZE_UCHAR;
-		unsigned int offset = index % SIZE_UCHAR;
-		return (vec[byteIndex]>> (SIZE_UCHAR - offset - 1)) & MASK_1;
+		if (complete && (bestBits < 0 || bits < bestBits)) {
+			best = candidate;
+			bestBits = bits;
+		}
+		if (ElapsedMs(start) > budgetMs) {
+			break;
+		}
 	}
+	return best;
+}
 
-	unsigned int GetSize() {
-		return size;
+/*
+ * Comma separated filter names, finest level first; the last one is
+ * repeated for the remaining levels. False on a name that is not a filter.
+ */
+bool ParseFilters(const std::wstring& list, std::vector<unsigned char>& filters) {
+	static const wchar_t* names[] = { L"box", L"hermite", L"triangle", L"bell", L"bspline", L"lanczos3", L"mitchell" };
+	filters.clear();
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = std::min(list.find(L',', start), list.size());
+		std::wstring name = list.substr(start, end - start);
+		unsigned char f = FILTER_BOX;
+		while (f <= FILTER_MITCHELL && name != names[f]) {
+			f++;
+		}
+		if (f > FILTER_MITCHELL) {
+			std::wcout << "Unknown filter " << name << "\n";
+			return false;
+		}
+		filters.push_back(f);
+		start = end + 1;
 	}
+	return true;
+}
 
-	std::vector<unsigned char>& GetBitVector() {
-		return vec;
-	}
+#define MODE_ROUNDTRIP		0
+#define MODE_COMPRESS		1
+#define MODE_DECOMPRESS		2
+#define MODE_VERIFY			3
+#define MODE_REPORT			4
+
+struct BatchSettings {
+	unsigned char mode;
+	std::wstring inputPath;
+	std::wstring outputPath;
+	std::wstring decompressedPath;
+	std::wstring pattern;
+	bool recursive;
+	CodecOptions options;
+	bool bench;
+	double targetPSNR;
+	unsigned long long targetSize;
+	double searchBudget;
+	unsigned int jobs;
+	unsigned long long memoryLimit;
+	unsigned int sample;
+	unsigned int alignment;
+	bool sync;
+	BatchSettings() :
+		mode(MODE_ROUNDTRIP),
+		recursive(false),
+		bench(false),
+		targetPSNR(0),
+		targetSize(0),
+		searchBudget(0),
+		jobs(1),
+		memoryLimit(0),
+		sample(1),
+		alignment(1),
+		sync(false) {}
+};
+
+struct ImageResult {
+	std::wstring log;
+	bool processed;
+	bool failed;
+	double pixels;
+	unsigned long long fileSize;
+	double loadMs;
+	double encodeMs;
+	double decodeMs;
+	double writeMs;
+	ImageResult() :
+		processed(false),
+		failed(false),
+		pixels(0),
+		fileSize(0),
+		loadMs(0),
+		encodeMs(0),
+		decodeMs(0),
+		writeMs(0) {}
 };
 
-struct Pyramid {
-	virtual unsigned char* GetCompressedData() const = 0;
-	virtual unsigned int GetCompressedSize() const = 0;
-	virtual unsigned int GetUncompressedSize() const = 0;
-	virtual unsigned char GetNumLevels() const = 0;
-	virtual KImage* GetTopImage() const = 0;
-	virtual unsigned int Downsample(unsigned int) const = 0;
-	virtual std::pair<unsigned int, unsigned int> GetDims() const = 0;
-	virtual ~Pyramid(){}
+/*
+ * One image in flight through the batch pipeline.
+ */
+struct BatchItem {
+	unsigned int index;
+	KImage* image;
+	Pyramid* pyramid;
+	KImage* decompressed;
+	unsigned long long workingSet;
 };
 
-struct ResidualPyramid : public Pyramid {
-private:
-	unsigned char* data;
-	KImage* topImage;
-	unsigned int compressedSize;
-	unsigned int uncompressedSize;
-	unsigned char numLevels;
-	std::pair<unsigned int, unsigned int> dims;
+/*
+ * Admission control for batch workers: an image is started only while the
+ * estimated working sets of the images in flight fit under the limit. An
+ * image larger than the whole limit still runs, alone. A limit of 0 admits
+ * everything.
+ */
+class MemoryBudget {
+	std::mutex mutex;
+	std::condition_variable released;
+	unsigned long long limit;
+	unsigned long long inUse;
 public:
-	ResidualPyramid() :
-		data(nullptr),
-		compressedSize(0),
-		uncompressedSize(0),
-		numLevels(0),
-		dims(std::make_pair(0, 0)),
-		topImage(nullptr) {}
+	MemoryBudget(unsigned long long maxBytes) : limit(maxBytes), inUse(0) {}
+	void Acquire(unsigned long long bytes) {
+		std::unique_lock<std::mutex> lock(mutex);
+		released.wait(lock, [&]() { return limit == 0 || inUse == 0 || inUse + bytes <= limit; });
+		inUse += bytes;
+	}
+	void Release(unsigned long long bytes) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			inUse -= bytes;
+		}
+		released.notify_all();
+	}
+};
+
+/*
+ * Compresses with the filter search and rate control the settings ask for;
+ * imageOptions receives the options the search picked.
+ */
+Pyramid* CompressWithSettings(KImage* image, const BatchSettings& settings, CodecOptions& imageOptions, long double* psnr) {
+	imageOptions = settings.searchBudget > 0 ? SearchFilters(image, settings.options, settings.searchBudget) : settings.options;
+	return settings.targetPSNR > 0 || settings.targetSize != 0 ? 
+		CompressToTarget(image, imageOptions, settings.targetPSNR, settings.targetSize, settings.alignment) : 
+		Compress(image, imageOptions, psnr);
+}
 
-	ResidualPyramid(unsigned char* d, unsigned int compSize, unsigned int uncompSize, unsigned char nl, 
-		std::pair<unsigned int, unsigned int> dims, KImage* topImg) :
-		data(d),
-		compressedSize(compSize),
-		uncompressedSize(uncompSize),
-		numLevels(nl),
-		dims(dims),
-		topImage(topImg) {}
+/*
+ * Encode stage: compresses the loaded image, and in the round trip mode
+ * decodes the result again, so the writer stage only has to put bytes on
+ * disk. All output goes to result.log so that concurrent images can be
+ * reported in input order.
+ */
+void EncodeImage(BatchItem& item, const std::wstring& inName, const BatchSettings& settings, ImageResult& result) {
+	KImage* pImage = item.image;
+	std::wostringstream log;
+	log << "Current image: " << inName << "\n";
 
-	unsigned char* GetCompressedData() const override {
-		return data;
+	auto start = std::chrono::high_resolution_clock::now();
+	CodecOptions imageOptions;
+	long double psnr = 0;
+	Pyramid* p = CompressWithSettings(pImage, settings, imageOptions, &psnr);
+	double encodeMs = ElapsedMs(start);
+	if (settings.searchBudget > 0) {
+		log << "Search picked ratio " << (int)p->GetOptions().ratio << ", filters";
+		for (auto f : p->GetOptions().filters) {
+			log << " " << (int)f;
+		}
+		log << "\n";
 	}
-	unsigned int GetCompressedSize() const override {
-		return compressedSize;
+
+	KImage* decomp = nullptr;
+	double decodeMs = 0;
+	if (settings.mode == MODE_ROUNDTRIP) {
+		start = std::chrono::high_resolution_clock::now();
+		decomp = Decompress(p);
+		decodeMs = ElapsedMs(start);
+		if (decomp != nullptr) {
+			psnr = PSNR(MSE(pImage, decomp));
+		}
+		else {
+			log << "Cannot decode the compressed image\n";
+			result.failed = true;
+		}
+	}
+
+	double pixels = double(pImage->GetWidth()) * pImage->GetHeight();
+	unsigned long long fileSize = EstimateFileSize(p, settings.alignment);
+	log << "Compressed size: " << fileSize << " bytes, " << 8.0 * fileSize / pixels << " bpp, "
+		<< "encode " << encodeMs << " ms";
+	if (decomp != nullptr) {
+		log << ", decode " << decodeMs << " ms";
+	}
+	log << "\n";
+	if (QuantStep(p->GetOptions(), 0) > 1 && psnr > 0) {
+		log << "Quantizer step " << QuantStep(p->GetOptions(), 0) << ", PSNR " 
+			<< (double)psnr << " dB\n";
+	}
+
+	if (settings.bench && p->GetNumSegments() > 1) {
+		unsigned long long prefixSize = fileSize - p->GetCompressedSize();
+		for (unsigned int layer = 1; layer <= p->GetNumSegments(); layer++) {
+			prefixSize += p->GetSegment(layer - 1).compressedSize;
+			KImage* partial = Decompress(p, layer);
+			if (partial == nullptr) {
+				log << "Layer " << layer << ": cannot decode\n";
+				break;
+			}
+			log << "Layer " << layer << ": " << prefixSize << " bytes, PSNR " 
+				<< (double)PSNR(MSE(pImage, partial)) << " dB\n";
+			delete partial;
+		}
 	}
-	unsigned int GetUncompressedSize() const override {
-		return uncompressedSize;
+
+	if (settings.bench && settings.options.predictor != PREDICT_NONE) {
+		CodecOptions plainOptions = imageOptions;
+		plainOptions.predictor = PREDICT_NONE;
+		start = std::chrono::high_resolution_clock::now();
+		Pyramid* plain = Compress(pImage, plainOptions);
+		double plainEncodeMs = ElapsedMs(start);
+		start = std::chrono::high_resolution_clock::now();
+		delete Decompress(plain);
+		double plainDecodeMs = ElapsedMs(start);
+		// Only the round trip mode has decoded the predicted pyramid already
+		double predictedDecodeMs = decodeMs;
+		if (decomp == nullptr) {
+			start = std::chrono::high_resolution_clock::now();
+			delete Decompress(p);
+			predictedDecodeMs = ElapsedMs(start);
+		}
+
+		long long sizeDelta = (long long)p->GetCompressedSize() - (long long)plain->GetCompressedSize();
+		log << "Prediction delta: " << sizeDelta << " bytes (" 
+			<< 100.0 * sizeDelta / plain->GetCompressedSize() << "%), "
+			<< "encode " << encodeMs - plainEncodeMs << " ms, decode " << predictedDecodeMs - plainDecodeMs << " ms\n";
+		delete plain;
 	}
-	unsigned char GetNumLevels() const override {
-		return numLevels;
+
+	delete pImage;
+	item.image = nullptr;
+	item.pyramid = p;
+	item.decompressed = decomp;
+
+	result.log = log.str();
+	result.pixels = pixels;
+	result.fileSize = fileSize;
+	result.encodeMs = encodeMs;
+	result.decodeMs = decodeMs;
+}
+
+/*
+ * Decode stage of the decompress and verify modes. Verify checks the stored
+ * segment checksums before decoding and the image checksum after, entirely
+ * in memory. Files written before checksums existed are compared with the
+ * original image instead; a pyramid with quantized levels is then expected
+ * to differ and only reports its PSNR.
+ */
+void DecodeImage(BatchItem& item, const std::wstring& inName, bool verify, ImageResult& result) {
+	std::wostringstream log;
+	log << "Current image: " << inName << "\n";
+	if (item.pyramid == nullptr) {
+		log << "Cannot read compressed file\n";
+		result.log = log.str();
+		result.failed = true;
+		return;
 	}
-	unsigned int Downsample(unsigned int dim) const override {
-		return unsigned int(dim / 3.0f + 0.5);
+	if (verify && item.pyramid->HasChecksums()) {
+		for (unsigned int i = 0; i < item.pyramid->GetNumSegments(); i++) {
+			const Segment& segment = item.pyramid->GetSegment(i);
+			if (Crc32c(segment.data, segment.compressedSize) != segment.checksum) {
+				log << "Verify: CORRUPT segment " << i << "\n";
+				result.log = log.str();
+				result.failed = true;
+				return;
+			}
+		}
 	}
-	KImage* GetTopImage() const override {
-		return topImage;
+	if (verify && !item.pyramid->HasChecksums() && item.image == nullptr) {
+		log << "Verify: no checksums and cannot read the original image\n";
+		result.log = log.str();
+		result.failed = true;
+		return;
 	}
-	std::pair<unsigned int, unsigned int> GetDims() const override {
-		return dims;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	item.decompressed = Decompress(item.pyramid);
+	result.decodeMs = ElapsedMs(start);
+	if (item.decompressed == nullptr) {
+		log << "Corrupt data, cannot decode\n";
+		result.log = log.str();
+		result.failed = true;
+		return;
 	}
-	~ResidualPyramid() override {
-		if (data != nullptr) {
-			delete data;
+	auto dims = item.pyramid->GetDims();
+	result.pixels = double(dims.first) * dims.second;
+	log << "Decoded " << dims.first << "x" << dims.second << ", decode " << result.decodeMs << " ms\n";
+
+	if (verify && item.pyramid->HasChecksums()) {
+		if (ImageChecksum(item.decompressed) != item.pyramid->GetImageChecksum()) {
+			log << "Verify: MISMATCH, image checksum\n";
+			result.failed = true;
 		}
-		if (topImage != nullptr) {
-			delete topImage;
+		else {
+			log << "Verify: OK\n";
 		}
 	}
-};
-
-Pyramid* Compress(KImage* image) {
-	unsigned char* data;
-	KImage* topImageData;
-	unsigned int dataSize;
-	BitVector signVec;
-	std::pair<unsigned int, unsigned int> dims;
-	unsigned char numLevels = 0;
-	std::vector<unsigned char> tmpData;
-	std::vector<unsigned int> header;
-	dims = std::make_pair(image->GetWidth(), image->GetHeight());
-
-	int newWidth = image->GetWidth();
-	int newHeight = image->GetHeight();
-	while (newWidth > MIN_IMG_WIDTH && newHeight > MIN_IMG_HEIGHT) {
-
-		newWidth = int(ResidualPyramid().Downsample(image->GetWidth()));
-		newHeight = int(ResidualPyramid().Downsample(image->GetHeight()));
-
-		if (newWidth > MIN_IMG_WIDTH && newHeight > MIN_IMG_HEIGHT) {
-
-			numLevels++;
-		
-			KImage* downsampledImage = new KImage(newWidth, newHeight, SIZE_UCHAR);
-			Resample(image, downsampledImage, FILTER_LANCZOS3);
-		
-			KImage upsampledImage(image->GetWidth(), image->GetHeight(), SIZE_UCHAR);
-			Resample(downsampledImage, &upsampledImage, FILTER_LANCZOS3);
-
-			auto data1 = image->GetDataMatrix();
-			auto data2 = upsampledImage.GetDataMatrix();
-
-			for (int i = 0; i < image->GetHeight(); i++) {
-				for (int j = 0; j < image->GetWidth(); j++) {
-					short diff =  data1[i][j] - data2[i][j];
-					if (diff + MAX_CHAR > MAX_UCHAR || diff + MAX_CHAR < 0) {
-						header.push_back(tmpData.size());
-						tmpData.push_back(std::abs(diff));
-						
-						unsigned char sign = diff < 0 ? 1 : 0;
-						signVec.Add(sign);
-						
-						continue;
-					}
-					tmpData.push_back(diff + MAX_CHAR);
-				}
+	else if (item.image != nullptr) {
+		bool lossless = true;
+		for (unsigned int level = 0; level < item.pyramid->GetNumLevels(); level++) {
+			lossless = lossless && QuantStep(item.pyramid->GetOptions(), level) <= 1;
+		}
+		if (item.image->GetWidth() != item.decompressed->GetWidth() || item.image->GetHeight() != item.decompressed->GetHeight()) {
+			log << "Verify: MISMATCH, size " << item.decompressed->GetWidth() << "x" << item.decompressed->GetHeight() 
+				<< " instead of " << item.image->GetWidth() << "x" << item.image->GetHeight() << "\n";
+			result.failed = true;
+		}
+		else {
+			long double mse = MSE(item.image, item.decompressed);
+			if (!lossless) {
+				log << "Verify: lossy, PSNR " << (double)PSNR(mse) << " dB\n";
+			}
+			else if (mse != 0) {
+				log << "Verify: MISMATCH, MSE " << (double)mse << "\n";
+				result.failed = true;
 			}
-			if (image->GetWidth() != dims.first && image->GetHeight() != dims.second) {
-				delete image;
+			else {
+				log << "Verify: OK\n";
 			}
-			image = downsampledImage;
 		}
+		delete item.image;
+		item.image = nullptr;
 	}
+	result.log = log.str();
+}
+
+/*
+ * Parent directory of a relative path, empty for files at the top.
+ */
+std::wstring ParentPath(const std::wstring& path) {
+	size_t slash = path.find_last_of(L"/\\");
+	return slash == std::wstring::npos ? std::wstring() : path.substr(0, slash);
+}
 
-	topImageData = image;
-	dataSize = sizeof(unsigned int) + 
-		header.size() * sizeof(unsigned int) + signVec.GetBitVector().size() + tmpData.size();
-	data = new unsigned char[dataSize];
+/*
+ * Batch pipeline: a reader thread loads the inputs of the mode (images,
+ * .pyr files or both), settings.jobs workers encode or decode them and a
+ * writer thread stores the results, with a BoundedQueue between each pair
+ * of stages. Full queues stall the stage before them, so at most a few
+ * images per worker are in memory on top of the -memory admission limit,
+ * while disk and CPU stay busy at the same time. Every image is processed
+ * the same way regardless of the worker count; logs are printed in input
+ * order as soon as all earlier images are done. Returns the number of
+ * images that failed.
+ */
+unsigned int ProcessBatch(const std::vector<std::wstring>& names, const BatchSettings& settings) {
+	auto start = std::chrono::high_resolution_clock::now();
+	unsigned int numWorkers = std::max(1u, std::min<unsigned int>(settings.jobs, names.size()));
+	std::vector<ImageResult> results(names.size());
+	std::vector<bool> done(names.size(), false);
+	std::mutex doneMutex;
+	std::condition_variable finished;
+	MemoryBudget budget(settings.memoryLimit);
+	BoundedQueue<BatchItem> loaded(PIPELINE_QUEUE_PER_JOB * numWorkers);
+	BoundedQueue<BatchItem> encoded(PIPELINE_QUEUE_PER_JOB * numWorkers);
+	bool readsImages = settings.mode == MODE_ROUNDTRIP || settings.mode == MODE_COMPRESS;
+	bool readsPyramids = settings.mode == MODE_DECOMPRESS || settings.mode == MODE_VERIFY;
 
-	Write(data, header.size());
-		
-	unsigned int offset = sizeof(unsigned int);
-	for (unsigned int i = 0; i < header.size(); i++) {
-		Write(data + offset, header[i]);
-		offset += sizeof(unsigned int);
+	if (settings.mode != MODE_VERIFY) {
+		std::wstring lastParent;
+		for (unsigned int i = 0; i < names.size(); i++) {
+			std::wstring parent = ParentPath(names[i]);
+			if (i == 0 || parent != lastParent) {
+				MakeDirectories(JoinPath(settings.outputPath, parent));
+				if (settings.mode == MODE_ROUNDTRIP) {
+					MakeDirectories(JoinPath(settings.decompressedPath, parent));
+				}
+			}
+			lastParent = parent;
+		}
 	}
 
-	for (auto el : signVec.GetBitVector()) {
-		Write(data + offset, el);
-		offset += sizeof(unsigned char);
+	auto finish = [&](unsigned int i) {
+		{
+			std::lock_guard<std::mutex> lock(doneMutex);
+			done[i] = true;
+		}
+		finished.notify_all();
+	};
+
+	std::thread reader([&]() {
+		for (unsigned int i = 0; i < names.size(); i++) {
+			auto loadStart = std::chrono::high_resolution_clock::now();
+			BatchItem item = { i, nullptr, nullptr, nullptr, 0 };
+			double waitMs = 0;
+			// Admission happens before the pixels are loaded, so the budget
+			// also bounds what the reader holds
+			auto admit = [&](double pixels) {
+				auto waitStart = std::chrono::high_resolution_clock::now();
+				item.workingSet = (unsigned long long)(pixels * WORKING_BYTES_PER_PIXEL);
+				budget.Acquire(item.workingSet);
+				waitMs = ElapsedMs(waitStart);
+			};
+			if (readsImages) {
+				std::wstring imageName = JoinPath(settings.inputPath, names[i]);
+				int width, height, bpp;
+				if (!KImage::ReadHeader(imageName.c_str(), width, height, bpp) || bpp != SIZE_UCHAR) {
+					finish(i);
+					continue;
+				}
+				admit(double(width) * height);
+				item.image = new KImage(imageName.c_str());
+				if (!item.image->IsValid() || item.image->GetBPP() != SIZE_UCHAR) {
+					delete item.image;
+					budget.Release(item.workingSet);
+					finish(i);
+					continue;
+				}
+			}
+			if (readsPyramids) {
+				std::wstring pyramidName = settings.mode == MODE_VERIFY ? 
+					JoinPath(settings.outputPath, ReplaceExtension(names[i], L"pyr")) : JoinPath(settings.inputPath, names[i]);
+				// Parsing only maps the file; the decoded size is known after it
+				item.pyramid = ReadCompressed(pyramidName);
+				results[i].fileSize = FileSize(pyramidName);
+				admit(item.pyramid != nullptr ? double(item.pyramid->GetDims().first) * item.pyramid->GetDims().second : 0);
+			}
+			// Only files without checksums need the original to verify against;
+			// without a usable one the file cannot be verified, which fails it
+			if (settings.mode == MODE_VERIFY && item.pyramid != nullptr && !item.pyramid->HasChecksums()) {
+				item.image = new KImage(JoinPath(settings.inputPath, names[i]).c_str());
+				if (!item.image->IsValid() || item.image->GetBPP() != SIZE_UCHAR) {
+					delete item.image;
+					item.image = nullptr;
+				}
+			}
+			results[i].loadMs = ElapsedMs(loadStart) - waitMs;
+			loaded.Push(item);
+		}
+		loaded.Close();
+	});
+
+	std::vector<std::thread> workers;
+	for (unsigned int w = 0; w < numWorkers; w++) {
+		workers.emplace_back([&]() {
+			BatchItem item;
+			while (loaded.Pop(item)) {
+				std::wstring inName = JoinPath(settings.inputPath, names[item.index]);
+				if (readsPyramids) {
+					DecodeImage(item, inName, settings.mode == MODE_VERIFY, results[item.index]);
+				}
+				else {
+					EncodeImage(item, inName, settings, results[item.index]);
+				}
+				encoded.Push(item);
+			}
+		});
 	}
 
-	for (unsigned int i = 0; i < tmpData.size(); i++) {
-		Write(data + offset, tmpData[i]);
-		offset += sizeof(unsigned char);
+	std::thread writer([&]() {
+		BatchItem item;
+		while (encoded.Pop(item)) {
+			const std::wstring& name = names[item.index];
+			auto writeStart = std::chrono::high_resolution_clock::now();
+			if (settings.mode == MODE_ROUNDTRIP || settings.mode == MODE_COMPRESS) {
+				std::wstring outName = JoinPath(settings.outputPath, ReplaceExtension(name, L"pyr"));
+				if (!WriteCompressed(item.pyramid, outName, settings.alignment, settings.sync)) {
+					results[item.index].log += L"Cannot write " + outName + L"\n";
+					results[item.index].failed = true;
+				}
+			}
+			if (settings.mode == MODE_ROUNDTRIP && item.decompressed != nullptr) {
+				std::wstring outName = JoinPath(settings.decompressedPath, name);
+				if (!item.decompressed->SaveAs(outName.c_str())) {
+					results[item.index].log += L"Cannot write " + outName + L"\n";
+					results[item.index].failed = true;
+				}
+			}
+			if (settings.mode == MODE_DECOMPRESS && item.decompressed != nullptr) {
+				std::wstring outName = JoinPath(settings.outputPath, ReplaceExtension(name, L"TIF"));
+				if (!item.decompressed->SaveAs(outName.c_str())) {
+					results[item.index].log += L"Cannot write " + outName + L"\n";
+					results[item.index].failed = true;
+				}
+			}
+			results[item.index].writeMs = ElapsedMs(writeStart);
+			results[item.index].processed = true;
+			delete item.image;
+			delete item.pyramid;
+			delete item.decompressed;
+			budget.Release(item.workingSet);
+			finish(item.index);
+		}
+	});
+
+	unsigned int processed = 0;
+	unsigned int failed = 0;
+	double pixels = 0;
+	unsigned long long bytes = 0;
+	double loadMs = 0;
+	double encodeMs = 0;
+	double decodeMs = 0;
+	double writeMs = 0;
+	for (unsigned int i = 0; i < names.size(); i++) {
+		{
+			std::unique_lock<std::mutex> lock(doneMutex);
+			finished.wait(lock, [&]() { return done[i]; });
+		}
+		const ImageResult& result = results[i];
+		if (!result.processed) {
+			continue;
+		}
+		std::wcout << result.log;
+		processed++;
+		failed += result.failed ? 1 : 0;
+		pixels += result.pixels;
+		bytes += result.fileSize;
+		loadMs += result.loadMs;
+		encodeMs += result.encodeMs;
+		decodeMs += result.decodeMs;
+		writeMs += result.writeMs;
 	}
 
-	char* dest = new char[dataSize];
-	unsigned int destLen = dataSize;
-	auto ret = BZ2_bzBuffToBuffCompress(
-		dest,
-		&destLen,
-		(char*)data,
-		dataSize,
-		M_BZ_BLK_SIZE,
-		M_BZ_VERB,
-		M_BZ_WORK_FACT
-	);
-	if (ret == BZ_OK) {
-		std::cout << "BZIP2 COMPRESSION OK\n";
+	reader.join();
+	for (auto& w : workers) {
+		w.join();
 	}
+	encoded.Close();
+	writer.join();
 
-	return new ResidualPyramid((unsigned char*)dest, destLen, dataSize, numLevels, dims, image);
+	double wallMs = ElapsedMs(start);
+	std::wcout << "Batch: " << processed << " images, " << names.size() - processed << " skipped, " << failed << " failed, "
+		<< numWorkers << " jobs, " << bytes << " bytes, " << (pixels > 0 ? 8.0 * bytes / pixels : 0) << " bpp, "
+		<< "encode " << encodeMs << " ms, decode " << decodeMs << " ms, wall " << wallMs << " ms, "
+		<< (wallMs > 0 ? pixels / wallMs / 1000.0 : 0) << " Mpixel/s\n";
+	std::wcout << "Pipeline: load " << loadMs << " ms, write " << writeMs << " ms, "
+		<< "load queue depth " << loaded.GetAverageDepth() << " avg " << loaded.GetMaxDepth() << " max of " << loaded.GetCapacity() << ", "
+		<< "write queue depth " << encoded.GetAverageDepth() << " avg " << encoded.GetMaxDepth() << " max of " << encoded.GetCapacity() << "\n";
+	return failed;
 }
 
-KImage* Decompress(Pyramid* residual) {
-	unsigned int sourceLen = residual->GetCompressedSize();
-	unsigned int destLen = residual->GetUncompressedSize();
-	char* dest = new char[destLen];
-
-	auto ret = BZ2_bzBuffToBuffDecompress(
-		dest,
-		&destLen,
-		(char*)residual->GetCompressedData(),
-		sourceLen,
-		M_BZ_SMALL,
-		M_BZ_VERB
-	);
+/*
+ * Corpus report: every image is encoded and decoded on its own, one after
+ * the other, so the timings belong to that image alone and not to a
+ * contended pipeline. The memory peak does too where ResetPeakResident can
+ * lower it before each image; elsewhere peakResident is 0 and only the
+ * corpus-wide peak is reported.
+ *
+ * levelEntropy is the zero-order entropy in bits per pixel of every level's
+ * residual, as the closed loop encoder sees it before quantization: the
+ * original level minus its prediction from the decoded level above. Empty
+ * for the wavelet transform, which has no such residuals.
+ */
+struct ReportRow {
+	std::wstring name;
+	unsigned int width;
+	unsigned int height;
+	unsigned int numLevels;
+	unsigned long long fileSize;
+	unsigned long long bzip2Size;
+	double encodeMs;
+	double decodeMs;
+	unsigned long long peakResident;
+	bool lossless;
+	double psnr;
+	std::vector<double> levelEntropy;
+};
 
-	if (ret == BZ_OK) {
-		std::cout << "BZIP2 DECOMPRESSION OK" << "\n\n";
+std::string Utf8(const std::wstring& text) {
+	std::string out;
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned long c = (unsigned long)text[i];
+		// UTF-16 surrogate pairs where wchar_t is 16 bits
+		if (c >= 0xD800 && c < 0xDC00 && i + 1 < text.size()) {
+			c = 0x10000 + ((c - 0xD800) << 10) + ((unsigned long)text[++i] - 0xDC00);
+		}
+		if (c < 0x80) {
+			out += (char)c;
+		}
+		else if (c < 0x800) {
+			out += (char)(0xC0 | (c >> 6));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			out += (char)(0xE0 | (c >> 12));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else {
+			out += (char)(0xF0 | (c >> 18));
+			out += (char)(0x80 | ((c >> 12) & 0x3F));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
 	}
+	return out;
+}
 
-	unsigned char* data = (unsigned char*) dest;
-	unsigned int size = destLen;
-	auto dims = residual->GetDims();
-	unsigned int numPositions = Read<unsigned int>(data);
-	unsigned int offset = sizeof(unsigned int);
+std::string CsvField(const std::string& text) {
+	if (text.find_first_of(",\"\n") == std::string::npos) {
+		return text;
+	}
+	std::string out = "\"";
+	for (auto c : text) {
+		out += c == '"' ? "\"\"" : std::string(1, c);
+	}
+	return out + "\"";
+}
 
-	std::vector<unsigned int> positions(numPositions);
-	if (numPositions != 0) {
-		std::memcpy(&positions[0], data + offset, numPositions * sizeof(unsigned int));
-		offset += (numPositions * sizeof(unsigned int));
+std::string JsonString(const std::string& text) {
+	std::ostringstream out;
+	out << '"';
+	for (auto c : text) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)(unsigned char)c << std::dec << std::setfill(' ');
+		}
+		else {
+			out << c;
+		}
 	}
+	out << '"';
+	return out.str();
+}
 
-	unsigned int numSigns = std::ceil(numPositions / float(SIZE_UCHAR));
-	std::vector<unsigned char> signs(numSigns);
-	if (numSigns != 0) {
-		std::memcpy(&signs[0], data + offset, numSigns);
-		offset += (numSigns * sizeof(unsigned char));
+/*
+ * Writes the rows and their aggregate as CSV (one line per image and a last
+ * line "(all)") or, for a .json file, as {"images": [...], "aggregate": {...}}.
+ * Ratios are raw size over compressed size; MB/s are of raw pixels.
+ */
+bool WriteReportFile(const std::wstring& file, const std::vector<ReportRow>& rows, unsigned long long peakResident) {
+	double pixels = 0;
+	double bytes = 0;
+	double bzip2Bytes = 0;
+	double encodeMs = 0;
+	double decodeMs = 0;
+	for (auto& row : rows) {
+		pixels += double(row.width) * row.height;
+		bytes += row.fileSize;
+		bzip2Bytes += row.bzip2Size;
+		encodeMs += row.encodeMs;
+		decodeMs += row.decodeMs;
 	}
+	auto rate = [](double numerator, double denominator) {
+		return denominator > 0 ? numerator / denominator : 0;
+	};
 
-	std::vector<short> res;
-	for (unsigned int i = offset; i < size; i++) {
-		
-		res.push_back((short)Read<unsigned char>(data + i) - MAX_CHAR);
+	std::ofstream out(StreamPath(file), std::ios::binary);
+	if (!out) {
+		return false;
+	}
+	out << std::fixed << std::setprecision(4);
+	bool json = MatchGlob(file, L"*.json");
+	if (json) {
+		out << "{\n  \"images\": [";
+		for (size_t i = 0; i < rows.size(); i++) {
+			auto& row = rows[i];
+			double rowPixels = double(row.width) * row.height;
+			out << (i == 0 ? "\n" : ",\n") << "    {\"file\": " << JsonString(Utf8(row.name)) 
+				<< ", \"width\": " << row.width << ", \"height\": " << row.height << ", \"levels\": " << row.numLevels
+				<< ", \"bytes\": " << row.fileSize << ", \"bpp\": " << 8.0 * row.fileSize / rowPixels
+				<< ", \"ratioRaw\": " << rate(rowPixels, double(row.fileSize)) << ", \"bzip2Bytes\": " << row.bzip2Size
+				<< ", \"ratioBzip2\": " << rate(double(row.bzip2Size), double(row.fileSize))
+				<< ", \"encodeMs\": " << row.encodeMs << ", \"encodeMBps\": " << rate(rowPixels, row.encodeMs * 1000.0)
+				<< ", \"decodeMs\": " << row.decodeMs << ", \"decodeMBps\": " << rate(rowPixels, row.decodeMs * 1000.0)
+				<< ", \"peakRssMB\": ";
+			if (row.peakResident != 0) {
+				out << row.peakResident / 1048576.0;
+			}
+			else {
+				out << "null";
+			}
+			out << ", \"lossless\": " << (row.lossless ? "true" : "false") << ", \"psnr\": ";
+			if (row.lossless) {
+				out << "null";
+			}
+			else {
+				out << row.psnr;
+			}
+			out << ", \"levelEntropy\": [";
+			for (size_t l = 0; l < row.levelEntropy.size(); l++) {
+				out << (l == 0 ? "" : ", ") << row.levelEntropy[l];
+			}
+			out << "]}";
+		}
+		out << "\n  ],\n  \"aggregate\": {\"images\": " << rows.size() << ", \"pixels\": " << std::setprecision(0) << pixels 
+			<< std::setprecision(4) << ", \"bytes\": " << bytes << ", \"bpp\": " << rate(8.0 * bytes, pixels)
+			<< ", \"ratioRaw\": " << rate(pixels, bytes) << ", \"bzip2Bytes\": " << bzip2Bytes << ", \"ratioBzip2\": " << rate(bzip2Bytes, bytes)
+			<< ", \"encodeMs\": " << encodeMs << ", \"encodeMBps\": " << rate(pixels, encodeMs * 1000.0)
+			<< ", \"decodeMs\": " << decodeMs << ", \"decodeMBps\": " << rate(pixels, decodeMs * 1000.0)
+			<< ", \"peakRssMB\": " << peakResident / 1048576.0 << "}\n}\n";
+	}
+	else {
+		out << "file,width,height,levels,bytes,bpp,ratio_raw,bzip2_bytes,ratio_bzip2,encode_ms,encode_mbps,"
+			<< "decode_ms,decode_mbps,peak_rss_mb,lossless,psnr_db,level_entropy_bpp\n";
+		for (auto& row : rows) {
+			double rowPixels = double(row.width) * row.height;
+			out << CsvField(Utf8(row.name)) << "," << row.width << "," << row.height << "," << row.numLevels << ","
+				<< row.fileSize << "," << 8.0 * row.fileSize / rowPixels << "," << rate(rowPixels, double(row.fileSize)) << ","
+				<< row.bzip2Size << "," << rate(double(row.bzip2Size), double(row.fileSize)) << ","
+				<< row.encodeMs << "," << rate(rowPixels, row.encodeMs * 1000.0) << ","
+				<< row.decodeMs << "," << rate(rowPixels, row.decodeMs * 1000.0) << ",";
+			if (row.peakResident != 0) {
+				out << row.peakResident / 1048576.0;
+			}
+			out << "," << (row.lossless ? 1 : 0) << ",";
+			if (!row.lossless) {
+				out << row.psnr;
+			}
+			out << ",";
+			for (size_t l = 0; l < row.levelEntropy.size(); l++) {
+				out << (l == 0 ? "" : ";") << row.levelEntropy[l];
+			}
+			out << "\n";
+		}
+		out << "(all),,,," << std::setprecision(0) << bytes << std::setprecision(4) << "," << rate(8.0 * bytes, pixels) << "," 
+			<< rate(pixels, bytes) << "," << std::setprecision(0) << bzip2Bytes << std::setprecision(4) << "," << rate(bzip2Bytes, bytes) << ","
+			<< encodeMs << "," << rate(pixels, encodeMs * 1000.0) << "," << decodeMs << "," << rate(pixels, decodeMs * 1000.0) << ","
+			<< peakResident / 1048576.0 << ",,,\n";
 	}
+	return out.good();
+}
+
+/*
+ * Report mode: measures every image and writes the report to outputPath.
+ * Returns the number of images that could not be read.
+ */
+unsigned int WriteReport(const std::vector<std::wstring>& names, const BatchSettings& settings) {
+	std::vector<ReportRow> rows;
+	unsigned int failed = 0;
+	bool peakPerImage = true;
+	unsigned long long peakResident = 0;
+	for (auto& name : names) {
+		peakPerImage = ResetPeakResident() && peakPerImage;
+		std::unique_ptr<KImage> image(new KImage(JoinPath(settings.inputPath, name).c_str()));
+		if (!image->IsValid() || image->GetBPP() != SIZE_UCHAR) {
+			std::wcout << "Cannot read " << name << "\n";
+			failed++;
+			continue;
+		}
+		ReportRow row;
+		row.name = name;
+		row.width = image->GetWidth();
+		row.height = image->GetHeight();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		CodecOptions imageOptions;
+		std::unique_ptr<Pyramid> p(CompressWithSettings(image.get(), settings, imageOptions, nullptr));
+		row.encodeMs = ElapsedMs(start);
+		start = std::chrono::high_resolution_clock::now();
+		std::unique_ptr<KImage> decoded(Decompress(p.get()));
+		row.decodeMs = ElapsedMs(start);
+		row.peakResident = PeakResidentBytes();
+		peakResident = std::max(peakResident, row.peakResident);
+
+		long double mse = MSE(image.get(), decoded.get());
+		row.lossless = mse == 0;
+		row.psnr = row.lossless ? 0 : (double)PSNR(mse);
+		row.numLevels = p->GetNumLevels();
+		row.fileSize = EstimateFileSize(p.get(), settings.alignment);
+		row.levelEntropy = p->GetLevelEntropies();
+
+		// Baseline: the raw pixels through the same bzip2 settings
+		std::vector<unsigned char> raw;
+		raw.reserve((size_t)row.width * row.height);
+		for (unsigned int i = 0; i < row.height; i++) {
+			raw.insert(raw.end(), image->GetDataMatrix()[i], image->GetDataMatrix()[i] + row.width);
+		}
+		Segment baseline = CompressSegment(raw);
+		row.bzip2Size = baseline.compressedSize;
+		delete[] baseline.data;
 
-	unsigned int index = 0;
-	BitVector bv(signs, numPositions);
-	for (auto el : positions) {
-		res[el] += MAX_CHAR;
-		res[el] = bv[index++] == 0 ? res[el] : -res[el];
+		std::wcout << name << ": " << 8.0 * row.fileSize / (double(row.width) * row.height) << " bpp, bzip2 " 
+			<< 8.0 * row.bzip2Size / (double(row.width) * row.height) << " bpp\n";
+		rows.push_back(row);
+	}
+	// Peaks not reset per image are all the process peak so far
+	if (!peakPerImage) {
+		for (auto& row : rows) {
+			row.peakResident = 0;
+		}
+		peakResident = PeakResidentBytes();
+	}
+	if (!WriteReportFile(settings.outputPath, rows, peakResident)) {
+		std::wcout << "Cannot write " << settings.outputPath << "\n";
+		return failed + 1;
 	}
+	return failed;
+}
+
+/*
+ * Micro-benchmarks: every kernel of the codec timed on its own, per image
+ * size, so that a regression can be traced to a stage and two engines of a
+ * stage compared. Each kernel runs once untimed and then repeat times; the
+ * report gives the mean in ns per pixel of the full image and in MB/s of the
+ * bytes the kernel consumes, with the spread of the runs (standard deviation
+ * as a percentage of the mean).
+ */
+struct BenchTiming {
+	double meanMs;
+	double minMs;
+	double deviation;
+};
 
-	std::vector<std::pair<unsigned int, unsigned int>> dimVec;
-	for (unsigned int i = 0; i < residual->GetNumLevels(); i++) {
-		dimVec.push_back(dims);
-		dims = std::make_pair(residual->Downsample(dims.first), 
-			residual->Downsample(dims.second));
+template <typename Prepare, typename Run>
+BenchTiming MeasureKernel(unsigned int repeat, Prepare prepare, Run run) {
+	prepare();
+	run();
+	std::vector<double> times;
+	for (unsigned int r = 0; r < repeat; r++) {
+		prepare();
+		auto start = std::chrono::high_resolution_clock::now();
+		run();
+		times.push_back(ElapsedMs(start));
+	}
+	BenchTiming timing;
+	timing.meanMs = 0;
+	timing.minMs = times[0];
+	for (auto t : times) {
+		timing.meanMs += t / times.size();
+		timing.minMs = std::min(timing.minMs, t);
 	}
+	double variance = 0;
+	for (auto t : times) {
+		variance += (t - timing.meanMs) * (t - timing.meanMs) / times.size();
+	}
+	timing.deviation = timing.meanMs > 0 ? 100.0 * std::sqrt(variance) / timing.meanMs : 0;
+	return timing;
+}
+
+void ReportKernel(const std::wstring& kernel, unsigned int width, unsigned int height, double bytes, const BenchTiming& timing) {
+	double pixels = double(width) * height;
+	std::wostringstream size;
+	size << width << "x" << height;
+	std::wcout << std::left << std::setw(28) << kernel << std::setw(12) << size.str() << std::right << std::fixed 
+		<< std::setprecision(3) << std::setw(10) << 1e6 * timing.meanMs / pixels << " ns/pixel "
+		<< std::setprecision(1) << std::setw(9) << (timing.meanMs > 0 ? bytes / timing.meanMs / 1000.0 : 0) << " MB/s "
+		<< std::setprecision(2) << std::setw(8) << timing.meanMs << " ms (min " << timing.minMs << ", +-" 
+		<< std::setprecision(1) << timing.deviation << "%)\n";
+	std::wcout.unsetf(std::ios::floatfield);
+	std::wcout << std::setprecision(6);
+}
 
-	std::reverse(dimVec.begin(), dimVec.end());
+/*
+ * Materializes a synthetic image; rows are independent, so they are
+ * generated in parallel bands.
+ */
+KImage* SyntheticKImage(const SyntheticImage& source) {
+	KImage* image = new KImage(source.GetWidth(), source.GetHeight(), SIZE_UCHAR);
+	ParallelRows(source.GetHeight(), [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			source.GenerateRow(i, image->GetDataMatrix()[i]);
+		}
+	});
+	return image;
+}
+
+struct MicroBenchSettings {
+	std::wstring scratchPath;
+	std::vector<std::pair<unsigned int, unsigned int>> sizes;
+	std::vector<unsigned char> filters;
+	unsigned int repeat;
+	int pattern;
+	unsigned long long seed;
+	MicroBenchSettings() :
+		repeat(5),
+		pattern(SYNTHETIC_PHOTO),
+		seed(1) {}
+};
 
-	offset = res.size();
-	KImage* pImage = residual->GetTopImage();
-	for (unsigned int di = 0; di < dimVec.size(); di++) {
-		auto dim = dimVec[di];
-		offset -= (dim.first * dim.second);
-		KImage* upsampledImage = new KImage(dim.first, dim.second, SIZE_UCHAR);
-		Resample(pImage, upsampledImage, FILTER_LANCZOS3);
-		auto data = upsampledImage->GetDataMatrix();
-		for (int i = 0; i < upsampledImage->GetHeight(); i++) {
-			for (int j = 0; j < upsampledImage->GetWidth(); j++) {
-				data[i][j] += res[offset + i * upsampledImage->GetWidth() + j];
+void RunMicroBench(const MicroBenchSettings& settings) {
+	static const wchar_t* filterNames[] = { L"box", L"hermite", L"triangle", L"bell", L"bspline", L"lanczos3", L"mitchell" };
+	auto nothing = []() {};
+	for (auto size : settings.sizes) {
+		unsigned int width = size.first;
+		unsigned int height = size.second;
+		double pixels = double(width) * height;
+		std::unique_ptr<KImage> image(SyntheticKImage(SyntheticImage(settings.pattern, width, height, settings.seed)));
+		std::wcout << SyntheticPatternName(settings.pattern) << " " << width << "x" << height << "\n";
+
+		for (auto filter : settings.filters) {
+			for (unsigned char ratio = MIN_RATIO; ratio <= MAX_SEARCH_RATIO; ratio++) {
+				std::unique_ptr<KImage> small(new KImage(ScaleDown(width, ratio), ScaleDown(height, ratio), SIZE_UCHAR));
+				std::unique_ptr<KImage> large(new KImage(width, height, SIZE_UCHAR));
+				std::wostringstream name;
+				name << "Resample " << filterNames[filter] << " 1/" << (int)ratio;
+				ReportKernel(name.str() + L" down", width, height, pixels, 
+					MeasureKernel(settings.repeat, nothing, [&]() { Resample(image.get(), small.get(), filter); }));
+				ReportKernel(name.str() + L" up", width, height, pixels, 
+					MeasureKernel(settings.repeat, nothing, [&]() { Resample(small.get(), large.get(), filter); }));
 			}
 		}
-		delete pImage;
-		pImage = upsampledImage;
+
+		// Residuals against the Lanczos3 prediction from one level down, as
+		// the encoder computes them
+		std::unique_ptr<KImage> small(new KImage(ScaleDown(width, PYRAMID_RATIO), ScaleDown(height, PYRAMID_RATIO), SIZE_UCHAR));
+		std::unique_ptr<KImage> upsampled(new KImage(width, height, SIZE_UCHAR));
+		Resample(image.get(), small.get(), FILTER_LANCZOS3);
+		Resample(small.get(), upsampled.get(), FILTER_LANCZOS3);
+		std::vector<short> residuals((size_t)width * height);
+		std::vector<unsigned char> codes((size_t)width * height);
+		ReportKernel(L"ComputeResiduals", width, height, 2 * pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			for (unsigned int i = 0; i < height; i++) {
+				ComputeResiduals(image->GetDataMatrix()[i], upsampled->GetDataMatrix()[i], width, &residuals[(size_t)i * width]);
+			}
+		}));
+		ReportKernel(L"BiasResiduals", width, height, 2 * pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			BiasResiduals(residuals.data(), (int)residuals.size(), codes.data());
+		}));
+		std::unique_ptr<KImage> applied(new KImage(width, height, SIZE_UCHAR));
+		ReportKernel(L"ApplyResiduals", width, height, 3 * pixels, MeasureKernel(settings.repeat, [&]() {
+			for (unsigned int i = 0; i < height; i++) {
+				std::memcpy(applied->GetDataMatrix()[i], upsampled->GetDataMatrix()[i], width);
+			}
+		}, [&]() {
+			for (unsigned int i = 0; i < height; i++) {
+				ApplyResiduals(applied->GetDataMatrix()[i], &residuals[(size_t)i * width], width, 1);
+			}
+		}));
+
+		ReportKernel(L"BitVector AppendSigns", width, height, 2 * pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			BitVector signs;
+			signs.Reserve((unsigned int)residuals.size());
+			signs.AppendSigns(residuals.data(), (unsigned int)residuals.size());
+		}));
+		ReportKernel(L"BitVector Append", width, height, pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			BitVector bits;
+			bits.Reserve((unsigned int)codes.size() * 2);
+			for (auto code : codes) {
+				bits.Append(code & 3, 2);
+			}
+		}));
+
+		Segment segment = CompressSegment(codes);
+		ReportKernel(L"bzip2 compress", width, height, pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			delete[] CompressSegment(codes).data;
+		}));
+		std::vector<unsigned char> inflated;
+		ReportKernel(L"bzip2 decompress", width, height, pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			DecompressSegment(segment, inflated);
+		}));
+		delete[] segment.data;
+
+		ReportKernel(L"MSE+PSNR", width, height, 2 * pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			PSNR(MSE(image.get(), upsampled.get()));
+		}));
+		std::unique_ptr<KImage> blurred(new KImage(width, height, SIZE_UCHAR));
+		ReportKernel(L"GaussianBlur r=2", width, height, pixels, MeasureKernel(settings.repeat, [&]() {
+			for (unsigned int i = 0; i < height; i++) {
+				std::memcpy(blurred->GetDataMatrix()[i], image->GetDataMatrix()[i], width);
+			}
+		}, [&]() {
+			blurred->GaussianBlur(2.0);
+		}));
+
+		// The whole codec, with its level chains and row bands on every core
+		ReportKernel(L"Compress", width, height, pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			delete Compress(image.get());
+		}));
+		std::unique_ptr<Pyramid> p(Compress(image.get()));
+		ReportKernel(L"Decompress", width, height, pixels, MeasureKernel(settings.repeat, nothing, [&]() {
+			delete Decompress(p.get());
+		}));
+
+		std::wstring file = JoinPath(settings.scratchPath, L"bench.pyr");
+		double fileBytes = (double)EstimateFileSize(p.get());
+		ReportKernel(L"WriteCompressed", width, height, fileBytes, MeasureKernel(settings.repeat, nothing, [&]() {
+			WriteCompressed(p.get(), file);
+		}));
+		ReportKernel(L"ReadCompressed", width, height, fileBytes, MeasureKernel(settings.repeat, nothing, [&]() {
+			delete ReadCompressed(file);
+		}));
+#ifdef _WIN32
+		_wremove(file.c_str());
+#else
+		std::remove(NarrowPath(file).c_str());
+#endif
+		std::wcout << "Peak resident " << PeakResidentBytes() / 1048576.0 << " MB\n";
 	}
+}
 
-	return pImage;
+void PrintUsage(const _TCHAR* program) {
+	std::wcout << "Usage:\n"
+		<< "  " << program << " compress <Input Folder> <Output Folder> [options]\n"
+		<< "  " << program << " decompress <Input Folder> <Output Folder> [options]\n"
+		<< "  " << program << " verify <Input Folder> <Compressed Folder> [options]\n"
+		<< "  " << program << " <Input Folder> <Output Folder Compressed> <Output Folder Decompressed> [options]\n"
+		<< "  " << program << " report <Input Folder> <Report File (.csv or .json)> [options]\n"
+		<< "  " << program << " bench <Scratch Folder> [-sizes <N|WxH>[,...]] [-repeat <N>] [-filter <name>[,<name>...]] "
+		<< "[-pattern <name>] [-seed <N>]\n"
+		<< "  " << program << " generate <Output Folder> [-sizes <N|WxH>[,...]] [-pattern <name>]... [-seed <N>] [-pgm]\n"
+		<< "The round trip form compresses, decompresses and saves every image; report measures size, "
+		<< "speed and residual entropy per image; bench times the codec kernels; generate writes synthetic images.\n"
+		<< "Patterns: gradient, noise, text, photo (default for bench; generate writes all unless given)\n"
+		<< "Files: [-r] [-include <glob>] (default *.tif, *.pyr for decompress)\n"
+		<< "Codec: [-predict] [-blocksize <N>] [-quant <step> | -psnr <dB> | -maxsize <bytes>] [-layers] [-wavelet] "
+		<< "[-ratio <N>] [-filter <name>[,<name>...]] [-search <ms>] [-adaptive] [-bench]\n"
+		<< "Batch: [-jobs <N>] [-memory <MB>] [-sample <N>] (verify every Nth file)\n"
+		<< "Output: [-align <bytes>] (section alignment, e.g. 4096 for direct I/O) [-sync] (flush each file to disk before it replaces the old one, so it survives a power loss)\n";
 }
 
-void WriteCompressed(Pyramid* p, const std::wstring& file) {
-	auto compressedDataSize = p->GetCompressedSize();
-	auto uncompressedDataSize = p->GetUncompressedSize();
-	auto compressedData = p->GetCompressedData();
-	auto dimsOrig = p->GetDims();
-	auto dimsTop = std::make_pair(p->GetTopImage()->GetWidth(), p->GetTopImage()->GetHeight());
-	auto numLevels = p->GetNumLevels();
-	auto topImageData = p->GetTopImage()->GetDataMatrix();
-
-	std::vector<unsigned char> vec;
-	for (unsigned int i = 0; i < p->GetTopImage()->GetHeight(); i++) {
-		for (unsigned int j = 0; j < p->GetTopImage()->GetWidth(); j++) {
-			vec.push_back(topImageData[i][j]);
-		}
-	}
-
-	std::ofstream out(file, std::ios::binary);
-	out.write("PYR", 3 * sizeof(unsigned char));
-	out.write((char*)(&dimsOrig.first), sizeof(unsigned int));
-	out.write((char*)(&dimsOrig.second), sizeof(unsigned int));
-	out.write((char*)(&numLevels), sizeof(unsigned char));
-	out.write((char*)(&compressedDataSize), sizeof(unsigned int));
-	out.write((char*)(&uncompressedDataSize), sizeof(unsigned int));
-	out.write((char*)(&dimsTop.first), sizeof(unsigned int));
-	out.write((char*)(&dimsTop.second), sizeof(unsigned int));
-	out.write((char*)(&vec[0]), vec.size() * sizeof(unsigned char));
-	out.write((char*)compressedData, compressedDataSize * sizeof(unsigned char));
-	out.close();
+/*
+ * Sizes as a comma separated list of N (square) or WxH.
+ */
+std::vector<std::pair<unsigned int, unsigned int>> ParseSizes(const std::wstring& list) {
+	std::vector<std::pair<unsigned int, unsigned int>> sizes;
+	std::wistringstream in(list);
+	std::wstring item;
+	while (std::getline(in, item, L',')) {
+		size_t x = item.find_first_of(L"xX");
+		unsigned int width = (unsigned int)std::stoul(item.substr(0, x));
+		unsigned int height = x == std::wstring::npos ? width : (unsigned int)std::stoul(item.substr(x + 1));
+		if (width > MIN_IMG_WIDTH && height > MIN_IMG_HEIGHT) {
+			sizes.push_back(std::make_pair(width, height));
+		}
+	}
+	return sizes;
 }
 
-Pyramid* ReadCompressed(const std::wstring& file) {
-	unsigned char ident[3];
-	unsigned int compressedDataSize;
-	unsigned int uncompressedDataSize;
-	unsigned char* compressedData;
-	unsigned char* topData;
-	unsigned char numLevels;
-	std::pair<unsigned int, unsigned int> dimsOrig;
-	std::pair<unsigned int, unsigned int> dimsTop;
-
-	std::ifstream in(file, std::ios::binary);
-	in.read((char*)(ident), 3 * sizeof(unsigned char));
-	in.read((char*)(&dimsOrig.first), sizeof(unsigned int));
-	in.read((char*)(&dimsOrig.second), sizeof(unsigned int));
-	in.read((char*)(&numLevels), sizeof(unsigned char));
-	in.read((char*)(&compressedDataSize), sizeof(unsigned int));
-	in.read((char*)(&uncompressedDataSize), sizeof(unsigned int));
-	in.read((char*)(&dimsTop.first), sizeof(unsigned int));
-	in.read((char*)(&dimsTop.second), sizeof(unsigned int));
-	topData = new unsigned char[dimsTop.first * dimsTop.second];
-	compressedData = new unsigned char[compressedDataSize];
-	in.read((char*)topData, dimsTop.first * dimsTop.second * sizeof(unsigned char));
-	in.read((char*)compressedData, compressedDataSize * sizeof(unsigned char));
-	in.close();
-
-	KImage* topImg = new KImage(dimsTop.first, dimsTop.second, SIZE_UCHAR);
-	for (unsigned int i = 0; i < dimsTop.second; i++) {
-		for (unsigned int j = 0; j < dimsTop.first; j++) { 
-			topImg->GetDataMatrix()[i][j] = topData[i * dimsTop.first + j];
-		}
-	}
-
-	return new ResidualPyramid(compressedData, compressedDataSize, 
-		uncompressedDataSize, numLevels, dimsOrig, topImg);
+int BenchMain(int argc, _TCHAR* argv[]) {
+	MicroBenchSettings settings;
+	settings.scratchPath = argv[2];
+	settings.sizes = ParseSizes(L"256,1024");
+	for (unsigned char f = FILTER_BOX; f <= FILTER_MITCHELL; f++) {
+		settings.filters.push_back(f);
+	}
+	for (int i = 3; i < argc; i++) {
+		std::wstring arg(argv[i]);
+		try {
+			if (arg == _T("-sizes") && i + 1 < argc) {
+				settings.sizes = ParseSizes(argv[++i]);
+			}
+			else if (arg == _T("-repeat") && i + 1 < argc) {
+				settings.repeat = std::max(1, std::stoi(argv[++i]));
+			}
+			else if (arg == _T("-filter") && i + 1 < argc) {
+				if (!ParseFilters(argv[++i], settings.filters)) {
+					PrintUsage(argv[0]);
+					return -1;
+				}
+			}
+			else if (arg == _T("-pattern") && i + 1 < argc && ParseSyntheticPattern(argv[i + 1]) >= 0) {
+				settings.pattern = ParseSyntheticPattern(argv[++i]);
+			}
+			else if (arg == _T("-seed") && i + 1 < argc) {
+				settings.seed = std::stoull(argv[++i]);
+			}
+			else {
+				std::wcout << "Unknown option " << arg << "\n";
+				PrintUsage(argv[0]);
+				return -1;
+			}
+		}
+		catch (const std::exception&) {
+			std::wcout << "Invalid value for " << arg << "\n";
+			PrintUsage(argv[0]);
+			return -1;
+		}
+	}
+	if (!MakeDirectories(settings.scratchPath)) {
+		std::wcout << "Cannot create " << settings.scratchPath << "\n";
+		return 1;
+	}
+	RunMicroBench(settings);
+	return 0;
 }
 
-void TestPrintFile(unsigned char* d, unsigned int size, const std::string& file) {
-	std::ofstream out(file);
-	for (unsigned int i = 0; i < size; i++) {
-		out << (int)d[i] << "\n";
+/*
+ * Writes synthetic images as TIF through FreeImage, or with pgm as binary
+ * PGM streamed row by row, which needs one row of memory whatever the size
+ * and can be read back by the batch modes with -include *.pgm.
+ */
+bool WriteSynthetic(const SyntheticImage& source, const std::wstring& file, bool pgm) {
+	if (!pgm) {
+		std::unique_ptr<KImage> image(SyntheticKImage(source));
+		return image->SaveAs(file.c_str());
 	}
-	out.close();
+	std::ofstream out(StreamPath(file), std::ios::binary);
+	out << "P5\n" << source.GetWidth() << " " << source.GetHeight() << "\n255\n";
+	std::vector<unsigned char> row(source.GetWidth());
+	for (unsigned int i = 0; i < source.GetHeight() && out; i++) {
+		source.GenerateRow(i, row.data());
+		out.write((char*)row.data(), row.size());
+	}
+	return out.good();
+}
+
+int GenerateMain(int argc, _TCHAR* argv[]) {
+	std::wstring outputPath = argv[2];
+	auto sizes = ParseSizes(L"1024");
+	std::vector<int> patterns;
+	unsigned long long seed = 1;
+	bool pgm = false;
+	for (int i = 3; i < argc; i++) {
+		std::wstring arg(argv[i]);
+		try {
+			if (arg == _T("-sizes") && i + 1 < argc) {
+				sizes = ParseSizes(argv[++i]);
+			}
+			else if (arg == _T("-pattern") && i + 1 < argc && ParseSyntheticPattern(argv[i + 1]) >= 0) {
+				patterns.push_back(ParseSyntheticPattern(argv[++i]));
+			}
+			else if (arg == _T("-seed") && i + 1 < argc) {
+				seed = std::stoull(argv[++i]);
+			}
+			else if (arg == _T("-pgm")) {
+				pgm = true;
+			}
+			else {
+				std::wcout << "Unknown option " << arg << "\n";
+				PrintUsage(argv[0]);
+				return -1;
+			}
+		}
+		catch (const std::exception&) {
+			std::wcout << "Invalid value for " << arg << "\n";
+			PrintUsage(argv[0]);
+			return -1;
+		}
+	}
+	if (patterns.empty()) {
+		for (int pattern = 0; pattern < NUMBER_OF_SYNTHETIC; pattern++) {
+			patterns.push_back(pattern);
+		}
+	}
+	if (!MakeDirectories(outputPath)) {
+		std::wcout << "Cannot create " << outputPath << "\n";
+		return 1;
+	}
+	unsigned int failed = 0;
+	for (auto size : sizes) {
+		for (auto pattern : patterns) {
+			std::wostringstream name;
+			name << SyntheticPatternName(pattern) << "_" << size.first << "x" << size.second << (pgm ? ".pgm" : ".tif");
+			std::wstring file = JoinPath(outputPath, name.str());
+			auto start = std::chrono::high_resolution_clock::now();
+			if (!WriteSynthetic(SyntheticImage(pattern, size.first, size.second, seed), file, pgm)) {
+				std::wcout << "Cannot write " << file << "\n";
+				failed++;
+				continue;
+			}
+			std::wcout << file << ": " << ElapsedMs(start) << " ms\n";
+		}
+	}
+	return failed != 0 ? 1 : 0;
 }
 
 int _tmain(int argc, _TCHAR* argv[])
 {
-	if (argc != 4)
+	if (argc > 2 && std::wstring(argv[1]) == _T("bench")) {
+		return BenchMain(argc, argv);
+	}
+	if (argc > 2 && std::wstring(argv[1]) == _T("generate")) {
+		return GenerateMain(argc, argv);
+	}
+	BatchSettings settings;
+	int first = 1;
+	if (argc > 1) {
+		std::wstring command(argv[1]);
+		if (command == _T("compress")) {
+			settings.mode = MODE_COMPRESS;
+		}
+		else if (command == _T("decompress")) {
+			settings.mode = MODE_DECOMPRESS;
+		}
+		else if (command == _T("verify")) {
+			settings.mode = MODE_VERIFY;
+		}
+		else if (command == _T("report")) {
+			settings.mode = MODE_REPORT;
+		}
+		first = settings.mode == MODE_ROUNDTRIP ? 1 : 2;
+	}
+	int numPaths = settings.mode == MODE_ROUNDTRIP ? 3 : 2;
+	if (argc < first + numPaths)
 	{
-		_tprintf(_T("Invalid program usage, correct syntax is: %s <Input Folder> <Output Folder Compressed> <Output Folder Deompressed> <CR>!\n"), argv[0]);
-		getchar();
+		PrintUsage(argv[0]);
 		return -1;
 	}
+	settings.inputPath = argv[first];
+	settings.outputPath = argv[first + 1];
+	if (settings.mode == MODE_ROUNDTRIP) {
+		settings.decompressedPath = argv[first + 2];
+	}
+	settings.pattern = settings.mode == MODE_DECOMPRESS ? L"*.pyr" : L"*.tif";
 
-	TCHAR szInputPath[_MAX_PATH], szOutputComp[_MAX_PATH], szFileMask[_MAX_PATH], szFileName[_MAX_PATH], szOutputDecomp[_MAX_PATH];
-	_tcscpy_s(szInputPath, argv[1]);
-	_tcscpy_s(szOutputComp, argv[2]);
-	_tcscpy_s(szOutputDecomp, argv[3]);
-	_stprintf_s(szFileMask, _MAX_PATH, _T("%s\\*.TIF"), szInputPath);
-	_tfinddata_t FindData;
-	intptr_t handleI, handleJ;
-	for (handleI = handleJ = _tfindfirst(szFileMask, &FindData); handleI != -1; handleI = _tfindnext(handleJ, &FindData)) {
-		if ((FindData.attrib & _A_SUBDIR) != 0)
-			continue;
-
-		_stprintf_s(szFileName, _MAX_PATH, _T("%s\\%s"), szInputPath, FindData.name);
-		KImage *pImage = new KImage(szFileName);
-		if (!pImage->IsValid() || pImage->GetBPP() != SIZE_UCHAR)
-		{
-			delete pImage;
-			continue;
+	CodecOptions& options = settings.options;
+	for (int i = first + numPaths; i < argc; i++) {
+		std::wstring arg(argv[i]);
+		try {
+			if (arg == _T("-predict")) {
+				options.predictor = PREDICT_MED;
+			}
+			else if (arg == _T("-blocksize") && i + 1 < argc) {
+				// Stored in one byte; 0 turns the significance map off
+				int blockSize = std::stoi(argv[++i]);
+				if (blockSize < 0 || blockSize > MAX_UCHAR) {
+					std::wcout << "Block size " << blockSize << " out of range 0 to " << MAX_UCHAR << "\n";
+					PrintUsage(argv[0]);
+					return -1;
+				}
+				options.blockSize = (unsigned char)blockSize;
+			}
+			else if (arg == _T("-quant") && i + 1 < argc) {
+				int step = std::stoi(argv[++i]);
+				if (step < 1 || step > MAX_QUANT_STEP) {
+					std::wcout << "Quantizer step " << step << " out of range 1 to " << MAX_QUANT_STEP << "\n";
+					PrintUsage(argv[0]);
+					return -1;
+				}
+				options.quantSteps.assign(1, (unsigned char)step);
+			}
+			else if (arg == _T("-psnr") && i + 1 < argc) {
+				settings.targetPSNR = std::stod(argv[++i]);
+			}
+			else if (arg == _T("-maxsize") && i + 1 < argc) {
+				settings.targetSize = std::stoull(argv[++i]);
+			}
+			else if (arg == _T("-layers")) {
+				options.bitPlanes = 1;
+			}
+			else if (arg == _T("-wavelet")) {
+				options.transform = TRANSFORM_WAVELET53;
+			}
+			else if (arg == _T("-ratio") && i + 1 < argc) {
+				int ratio = std::stoi(argv[++i]);
+				if (ratio < MIN_RATIO || ratio > MAX_UCHAR) {
+					std::wcout << "Ratio " << ratio << " out of range " << MIN_RATIO << " to " << MAX_UCHAR << "\n";
+					PrintUsage(argv[0]);
+					return -1;
+				}
+				options.ratio = (unsigned char)ratio;
+			}
+			else if (arg == _T("-filter") && i + 1 < argc) {
+				if (!ParseFilters(argv[++i], options.filters)) {
+					PrintUsage(argv[0]);
+					return -1;
+				}
+			}
+			else if (arg == _T("-search") && i + 1 < argc) {
+				settings.searchBudget = std::stod(argv[++i]);
+			}
+			else if (arg == _T("-adaptive")) {
+				options.adaptiveLevels = true;
+			}
+			else if (arg == _T("-bench")) {
+				settings.bench = true;
+			}
+			else if (arg == _T("-jobs") && i + 1 < argc) {
+				int jobs = std::stoi(argv[++i]);
+				settings.jobs = jobs > 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
+			}
+			else if (arg == _T("-memory") && i + 1 < argc) {
+				settings.memoryLimit = std::stoull(argv[++i]) << 20;
+			}
+			else if (arg == _T("-r")) {
+				settings.recursive = true;
+			}
+			else if (arg == _T("-include") && i + 1 < argc) {
+				settings.pattern = argv[++i];
+			}
+			else if (arg == _T("-sample") && i + 1 < argc) {
+				settings.sample = std::max(1, std::stoi(argv[++i]));
+			}
+			else if (arg == _T("-align") && i + 1 < argc) {
+				settings.alignment = std::max(1, std::stoi(argv[++i]));
+			}
+			else if (arg == _T("-sync")) {
+				settings.sync = true;
+			}
+			else {
+				std::wcout << "Unknown option " << arg << "\n";
+				PrintUsage(argv[0]);
+				return -1;
+			}
+		}
+		catch (const std::exception&) {
+			// Numbers are parsed with stoi and friends, which throw on malformed input
+			std::wcout << "Invalid value for " << arg << "\n";
+			PrintUsage(argv[0]);
+			return -1;
 		}
-		
-		std::wcout << "Current image: " << std::wstring(szFileName) << "\n";
+	}
 
-		Pyramid* p = Compress(pImage);
-		std::wstring inName(szFileName);
-		std::wstring outComp(std::wstring(szOutputComp) + 
-			inName.substr(7, inName.size() - 10) + std::wstring(_T("pyr")));
-		std::wstring outDecomp(std::wstring(szOutputDecomp) + 
-			inName.substr(7, inName.size()));
-		WriteCompressed(p, outComp);
+	std::vector<std::wstring> names = ScanDirectory(settings.inputPath, settings.pattern, settings.recursive);
+	if (settings.mode == MODE_VERIFY && settings.sample > 1) {
+		std::vector<std::wstring> sampled;
+		for (unsigned int i = 0; i < names.size(); i += settings.sample) {
+			sampled.push_back(names[i]);
+		}
+		names.swap(sampled);
+	}
+	unsigned int failed = settings.mode == MODE_REPORT ? WriteReport(names, settings) : ProcessBatch(names, settings);
 
-		auto compFromFile = ReadCompressed(outComp);
-		auto decomp = Decompress(compFromFile);
-		decomp->SaveAs(outDecomp.c_str());
+	return failed != 0 ? 1 : 0;
+}
 
-		delete pImage;
-		delete p;
-		delete decomp;
+#ifndef _WIN32
+/*
+ * POSIX entry point: the arguments are converted to the wide strings the rest
+ * of the program uses with the user's locale, as file names are.
+ */
+int main(int argc, char* argv[])
+{
+	setlocale(LC_ALL, "");
+	std::vector<std::wstring> args;
+	for (int i = 0; i < argc; i++) {
+		args.push_back(WidePath(argv[i]));
 	}
-	_findclose(handleJ);
-
-	return 0;
-}
\ No newline at end of file
+	std::vector<_TCHAR*> wideArgv;
+	for (auto& arg : args) {
+		wideArgv.push_back(&arg[0]);
+	}
+	wideArgv.push_back(nullptr);
+	return _tmain(argc, wideArgv.data());
+}
+#endif
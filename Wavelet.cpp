@@ -0,0 +1,194 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Wavelet. Reversible integer 5/3 lifting transform
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#include "stdafx.h"
+#include "Wavelet.h"
+
+#include <vector>
+#include <algorithm>
+//===========================================================================
+//===========================================================================
+
+/*
+ *
+ *    Lifting helpers
+ *
+ *    Predict53 takes the two even samples around an odd one, Update53 the
+ *    two details around an even one; callers mirror them at the borders.
+ *    Floor division is an arithmetic shift, as in the JPEG 2000 reference.
+ *
+ */
+//===========================================================================
+//===========================================================================
+static inline int Predict53(int intEven, int intNext)
+{
+	return (intEven + intNext) >> 1;
+}
+
+static inline int Update53(int intPrev, int intNext)
+{
+	return (intPrev + intNext + 2) >> 2;
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static void ForwardLine(int* pLine, int intLength, int* pScratch)
+{
+	int intLow = (intLength + 1) / 2;
+	int intHigh = intLength / 2;
+	if (intHigh == 0)
+		return;
+
+	int* pS = pScratch;
+	int* pD = pScratch + intLow;
+	for (int i = 0; i < intHigh; i++)
+	{
+		int intNext = 2 * i + 2 < intLength ? pLine[2 * i + 2] : pLine[2 * i];
+		pD[i] = pLine[2 * i + 1] - Predict53(pLine[2 * i], intNext);
+	}
+	for (int i = 0; i < intLow; i++)
+	{
+		int intPrev = pD[std::max(i - 1, 0)];
+		int intNext = pD[std::min(i, intHigh - 1)];
+		pS[i] = pLine[2 * i] + Update53(intPrev, intNext);
+	}
+	std::copy(pScratch, pScratch + intLength, pLine);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static void InverseLine(int* pLine, int intLength, int* pScratch)
+{
+	int intLow = (intLength + 1) / 2;
+	int intHigh = intLength / 2;
+	if (intHigh == 0)
+		return;
+
+	const int* pS = pLine;
+	const int* pD = pLine + intLow;
+	for (int i = 0; i < intLow; i++)
+	{
+		int intPrev = pD[std::max(i - 1, 0)];
+		int intNext = pD[std::min(i, intHigh - 1)];
+		pScratch[2 * i] = pS[i] - Update53(intPrev, intNext);
+	}
+	for (int i = 0; i < intHigh; i++)
+	{
+		int intNext = 2 * i + 2 < intLength ? pScratch[2 * i + 2] : pScratch[2 * i];
+		pScratch[2 * i + 1] = pD[i] + Predict53(pScratch[2 * i], intNext);
+	}
+	std::copy(pScratch, pScratch + intLength, pLine);
+}
+//===========================================================================
+//===========================================================================
+
+/*
+ *
+ *    Vertical passes
+ *
+ *    Same lifting steps as the line versions, with a whole row of intWidth
+ *    samples standing in for every sample.
+ *
+ */
+//===========================================================================
+//===========================================================================
+static void ForwardColumns(int* pData, int intWidth, int intHeight, int intStride)
+{
+	int intLow = (intHeight + 1) / 2;
+	int intHigh = intHeight / 2;
+	if (intHigh == 0)
+		return;
+
+	std::vector<int> scratch(intWidth * intHeight);
+	for (int i = 0; i < intHigh; i++)
+	{
+		const int* pEven = pData + (2 * i) * intStride;
+		const int* pOdd = pData + (2 * i + 1) * intStride;
+		const int* pNext = 2 * i + 2 < intHeight ? pData + (2 * i + 2) * intStride : pEven;
+		int* pD = &scratch[(intLow + i) * intWidth];
+		for (int x = 0; x < intWidth; x++)
+			pD[x] = pOdd[x] - Predict53(pEven[x], pNext[x]);
+	}
+	for (int i = 0; i < intLow; i++)
+	{
+		const int* pEven = pData + (2 * i) * intStride;
+		const int* pPrev = &scratch[(intLow + std::max(i - 1, 0)) * intWidth];
+		const int* pNext = &scratch[(intLow + std::min(i, intHigh - 1)) * intWidth];
+		int* pS = &scratch[i * intWidth];
+		for (int x = 0; x < intWidth; x++)
+			pS[x] = pEven[x] + Update53(pPrev[x], pNext[x]);
+	}
+	for (int y = 0; y < intHeight; y++)
+		std::copy(&scratch[y * intWidth], &scratch[y * intWidth] + intWidth, pData + y * intStride);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+static void InverseColumns(int* pData, int intWidth, int intHeight, int intStride)
+{
+	int intLow = (intHeight + 1) / 2;
+	int intHigh = intHeight / 2;
+	if (intHigh == 0)
+		return;
+
+	std::vector<int> scratch(intWidth * intHeight);
+	for (int i = 0; i < intLow; i++)
+	{
+		const int* pS = pData + i * intStride;
+		const int* pPrev = pData + (intLow + std::max(i - 1, 0)) * intStride;
+		const int* pNext = pData + (intLow + std::min(i, intHigh - 1)) * intStride;
+		int* pEven = &scratch[(2 * i) * intWidth];
+		for (int x = 0; x < intWidth; x++)
+			pEven[x] = pS[x] - Update53(pPrev[x], pNext[x]);
+	}
+	for (int i = 0; i < intHigh; i++)
+	{
+		const int* pD = pData + (intLow + i) * intStride;
+		const int* pEven = &scratch[(2 * i) * intWidth];
+		const int* pNext = 2 * i + 2 < intHeight ? &scratch[(2 * i + 2) * intWidth] : pEven;
+		int* pOdd = &scratch[(2 * i + 1) * intWidth];
+		for (int x = 0; x < intWidth; x++)
+			pOdd[x] = pD[x] + Predict53(pEven[x], pNext[x]);
+	}
+	for (int y = 0; y < intHeight; y++)
+		std::copy(&scratch[y * intWidth], &scratch[y * intWidth] + intWidth, pData + y * intStride);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void ForwardWavelet53(int* pData, int intWidth, int intHeight, int intStride)
+{
+	std::vector<int> scratch(intWidth);
+	for (int y = 0; y < intHeight; y++)
+		ForwardLine(pData + y * intStride, intWidth, &scratch[0]);
+	ForwardColumns(pData, intWidth, intHeight, intStride);
+}
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+void InverseWavelet53(int* pData, int intWidth, int intHeight, int intStride)
+{
+	InverseColumns(pData, intWidth, intHeight, intStride);
+	std::vector<int> scratch(intWidth);
+	for (int y = 0; y < intHeight; y++)
+		InverseLine(pData + y * intStride, intWidth, &scratch[0]);
+}
+//===========================================================================
+//===========================================================================
@@ -0,0 +1,49 @@
+//===========================================================================
+//===========================================================================
+//===========================================================================
+//==  Wavelet. Reversible integer 5/3 lifting transform
+//===========================================================================
+//===========================================================================
+//===========================================================================
+
+//===========================================================================
+//===========================================================================
+#ifndef __WAVELET__H__
+#define __WAVELET__H__
+//===========================================================================
+//===========================================================================
+
+/*
+
+Summary:
+
+- One level of the LeGall 5/3 wavelet (the JPEG 2000 reversible filter),
+computed with two integer lifting steps per dimension:
+
+	d[i] = x[2i + 1] - floor((x[2i] + x[2i + 2]) / 2)
+	s[i] = x[2i] + floor((d[i - 1] + d[i] + 2) / 4)
+
+Borders use symmetric extension. Every step is undone exactly by the inverse,
+so the transform is lossless without any floating point.
+
+- The plane is transformed in place in Mallat layout: after a level the low
+band LL occupies the top-left ceil(w/2) x ceil(h/2) corner, and the next level
+is applied to that corner only (intStride stays the width of the full plane).
+
+- The vertical pass lifts whole rows against whole rows, so its inner loops
+run over contiguous memory and vectorize; the horizontal pass works on one
+row at a time through a scratch line.
+
+*/
+
+//===========================================================================
+//===========================================================================
+void ForwardWavelet53(int* pData, int intWidth, int intHeight, int intStride);
+void InverseWavelet53(int* pData, int intWidth, int intHeight, int intStride);
+//===========================================================================
+//===========================================================================
+
+#endif
+/*! \} */
+//===========================================================================
+//===========================================================================
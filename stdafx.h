@@ -5,12 +5,21 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
+#endif
 #include "bzip2/bzlib.h"
 
 
 #include <stdio.h>
+#ifdef _WIN32
 #include <tchar.h>
+#else
+// The Unicode subset of tchar.h the program uses; _tmain is called from main
+typedef wchar_t _TCHAR;
+typedef wchar_t TCHAR;
+#define _T(x)	L ## x
+#endif
 
 // TODO: reference additional headers your program requires here
 
@@ -20,5 +29,7 @@
 #include <memory.h>
 #include <string.h>
 #include <stdlib.h>
+#ifdef _WIN32
 #include <io.h>
+#endif
 #include <wchar.h>